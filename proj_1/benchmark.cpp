@@ -0,0 +1,401 @@
+#include "benchmark.h"
+#include "bp_tree.h"
+#include "key_search.h"
+#include "parallel.h"
+#include "scan_kernel.h"
+#include "simd.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+constexpr int KEY_SEARCH_PROBES = 1 << 20;
+constexpr int SCAN_VALUES = 1 << 22;
+constexpr int LOOKUP_KEYS = 1 << 18;
+constexpr int LOOKUPS_PER_THREAD = 1 << 18;
+constexpr int MIXED_OPERATIONS_PER_THREAD = 1 << 17;
+constexpr int COMMITS_PER_THREAD = 1 << 9;
+// Inserts arrive in batches, with a pause between them.
+constexpr int STREAMED_INSERT_BATCHES = 32;
+constexpr int STREAMED_INSERTS_PER_BATCH = 1 << 10;
+constexpr std::chrono::milliseconds STREAMED_INSERT_PAUSE{20};
+
+void benchmark_key_search() {
+  std::cout << "Key search (" << simd_instruction_set() << ", "
+            << KEY_SEARCH_PROBES << " searches per node size)" << std::endl;
+  std::cout << std::setiosflags(std::ios::right);
+  std::cout << std::setw(16) << "Keys";
+  std::cout << std::setw(16) << "Binary (ns)";
+  std::cout << std::setw(16) << "SIMD (ns)" << std::endl;
+
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> distribution(0, 1);
+  for (size_t key_count : {8, 16, 32, 68, 128, 256, 512, 1024}) {
+    std::vector<float> keys(key_count);
+    for (auto &key : keys)
+      key = distribution(rng);
+    std::sort(keys.begin(), keys.end());
+    std::vector<float> probes(KEY_SEARCH_PROBES);
+    for (auto &probe : probes)
+      probe = distribution(rng);
+
+    // Sum the results so that the searches are not optimized away.
+    size_t binary_sum = 0, simd_sum = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto probe : probes)
+      binary_sum +=
+          std::lower_bound(keys.data(), keys.data() + key_count, probe) -
+          keys.data();
+    auto middle = std::chrono::high_resolution_clock::now();
+    for (auto probe : probes)
+      simd_sum += count_keys_less(keys.data(), key_count, probe);
+    auto end = std::chrono::high_resolution_clock::now();
+    if (binary_sum != simd_sum)
+      throw std::runtime_error("Key search results do not match.");
+
+    std::chrono::duration<double, std::nano> binary_time = middle - start;
+    std::chrono::duration<double, std::nano> simd_time = end - middle;
+    std::cout << std::setw(16) << key_count;
+    std::cout << std::setw(16) << binary_time.count() / KEY_SEARCH_PROBES;
+    std::cout << std::setw(16) << simd_time.count() / KEY_SEARCH_PROBES;
+    std::cout << std::endl;
+  }
+  std::cout << std::resetiosflags(std::ios::right);
+}
+
+void benchmark_scan_kernel() {
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> distribution(0, 1);
+  std::vector<float> values(SCAN_VALUES);
+  for (auto &value : values)
+    value = distribution(rng);
+
+  std::cout << "Range aggregate (" << simd_instruction_set() << ", "
+            << SCAN_VALUES << " values)" << std::endl;
+  std::cout << std::setiosflags(std::ios::right);
+  std::cout << std::setw(16) << "Selectivity";
+  std::cout << std::setw(16) << "Scalar (ns)";
+  std::cout << std::setw(16) << "SIMD (ns)" << std::endl;
+  // Random values make the scalar branch hardest to predict at 50%.
+  for (float selectivity : {0.01f, 0.1f, 0.5f, 0.9f}) {
+    float lo = 0.5f - selectivity / 2, hi = 0.5f + selectivity / 2;
+    auto start = std::chrono::high_resolution_clock::now();
+    size_t scalar_count = 0;
+    double scalar_sum = 0;
+    for (auto value : values) {
+      if (value >= lo && value <= hi) {
+        ++scalar_count;
+        scalar_sum += value;
+      }
+    }
+    auto middle = std::chrono::high_resolution_clock::now();
+    auto aggregate = aggregate_range(values.data(), values.size(), lo, hi);
+    auto end = std::chrono::high_resolution_clock::now();
+    if (aggregate.count != scalar_count)
+      throw std::runtime_error("Range aggregate results do not match.");
+
+    std::chrono::duration<double, std::nano> scalar_time = middle - start;
+    std::chrono::duration<double, std::nano> simd_time = end - middle;
+    std::cout << std::setw(16) << selectivity;
+    std::cout << std::setw(16) << scalar_time.count() / SCAN_VALUES;
+    std::cout << std::setw(16) << simd_time.count() / SCAN_VALUES;
+    // Printing the sum keeps the scalar loop from being optimized away.
+    std::cout << " (sum " << scalar_sum << ")" << std::endl;
+  }
+  std::cout << std::resetiosflags(std::ios::right);
+}
+
+// Runs LOOKUPS_PER_THREAD point lookups on each of thread_count threads and
+// returns the total number of lookups per second.
+static double run_lookups(const BPlusTree<float> &tree, int thread_count) {
+  std::atomic<size_t> found{0};
+  auto start = std::chrono::high_resolution_clock::now();
+  parallel_for(thread_count, [&](int thread) {
+    std::mt19937 rng(thread);
+    std::vector<RecordPointer> batch;
+    size_t thread_found = 0;
+    for (int i = 0; i < LOOKUPS_PER_THREAD; ++i) {
+      float key = (float)(rng() % LOOKUP_KEYS) / LOOKUP_KEYS;
+      auto scan = tree.scan(key, key);
+      if (scan.next(batch))
+        thread_found += batch.size();
+    }
+    found += thread_found;
+  });
+  auto end = std::chrono::high_resolution_clock::now();
+  // Keys inserted meanwhile lie between the loaded ones, so never match.
+  if (found != (size_t)thread_count * LOOKUPS_PER_THREAD)
+    throw std::runtime_error("Concurrent lookups missed keys.");
+  std::chrono::duration<double> time = end - start;
+  return thread_count * LOOKUPS_PER_THREAD / time.count();
+}
+
+// Loads keys i / LOOKUP_KEYS, each with one record.
+static void load_lookup_keys(BPlusTree<float> &tree) {
+  std::vector<BulkLoadEntry<float>> entries;
+  for (int i = 0; i < LOOKUP_KEYS; ++i)
+    entries.push_back({.key = (float)i / LOOKUP_KEYS,
+                       .record = {.block_id = i, .offset = 0}});
+  tree.bulk_load(std::move(entries));
+}
+
+void benchmark_concurrent_lookups() {
+  Storage storage("data/bench_", 0, 0, 0);
+  BPlusTree<float> tree(&storage,
+                        Node::max_record_count<float>(storage.block_size));
+  load_lookup_keys(tree);
+
+  std::cout << "Concurrent lookups (" << LOOKUP_KEYS << " keys, "
+            << LOOKUPS_PER_THREAD << " lookups per thread, "
+            << default_thread_count() << " hardware threads)" << std::endl;
+  std::cout << std::setiosflags(std::ios::right);
+  std::cout << std::setw(16) << "Threads";
+  std::cout << std::setw(16) << "Lookups/s";
+  std::cout << std::setw(16) << "Speedup";
+  std::cout << std::setw(16) << "With writer" << std::endl;
+  double single_thread = 0;
+  for (int thread_count = 1;; thread_count *= 2) {
+    thread_count = std::min(thread_count, default_thread_count());
+    auto throughput = run_lookups(tree, thread_count);
+    if (thread_count == 1)
+      single_thread = throughput;
+
+    // The writer inserts keys halfway between the loaded ones until the
+    // readers are done.
+    std::atomic<bool> done{false};
+    std::thread writer([&] {
+      std::mt19937 rng(thread_count);
+      while (!done) {
+        int i = rng() % LOOKUP_KEYS;
+        tree.insert((i + 0.5f) / LOOKUP_KEYS, {.block_id = i, .offset = 1});
+      }
+    });
+    double mixed_throughput;
+    try {
+      mixed_throughput = run_lookups(tree, thread_count);
+    } catch (...) {
+      done = true;
+      writer.join();
+      throw;
+    }
+    done = true;
+    writer.join();
+
+    std::cout << std::setw(16) << thread_count;
+    std::cout << std::setw(16) << (size_t)throughput;
+    std::cout << std::setw(16) << throughput / single_thread;
+    std::cout << std::setw(16) << (size_t)mixed_throughput << std::endl;
+    if (thread_count == default_thread_count())
+      break;
+  }
+  std::cout << std::resetiosflags(std::ios::right);
+}
+
+// Runs MIXED_OPERATIONS_PER_THREAD operations on each of thread_count threads
+// against a freshly loaded tree, of which write_percent are inserts and the
+// rest lookups. Returns the total number of operations per second.
+static double run_mixed_workload(int thread_count, int write_percent) {
+  Storage storage("data/bench_", 0, 0, 0);
+  BPlusTree<float> tree(&storage,
+                        Node::max_record_count<float>(storage.block_size));
+  load_lookup_keys(tree);
+
+  std::atomic<size_t> inserted{0}, missed{0};
+  auto start = std::chrono::high_resolution_clock::now();
+  parallel_for(thread_count, [&](int thread) {
+    std::mt19937 rng(thread);
+    std::vector<RecordPointer> batch;
+    size_t thread_inserted = 0, thread_missed = 0;
+    for (int i = 0; i < MIXED_OPERATIONS_PER_THREAD; ++i) {
+      int k = rng() % LOOKUP_KEYS;
+      if ((int)(rng() % 100) < write_percent) {
+        // Both new keys and further records of loaded keys.
+        float key = (k + (rng() % 2) * 0.5f) / LOOKUP_KEYS;
+        tree.insert(key, {.block_id = k, .offset = 1});
+        ++thread_inserted;
+      } else {
+        auto scan = tree.scan((float)k / LOOKUP_KEYS, (float)k / LOOKUP_KEYS);
+        if (!scan.next(batch))
+          ++thread_missed;
+      }
+    }
+    inserted += thread_inserted;
+    missed += thread_missed;
+  });
+  auto end = std::chrono::high_resolution_clock::now();
+
+  size_t record_count = 0;
+  std::vector<RecordPointer> batch;
+  auto scan = tree.scan(-1, 2);
+  while (scan.next(batch))
+    record_count += batch.size();
+  if (missed > 0 || record_count != LOOKUP_KEYS + inserted)
+    throw std::runtime_error("Mixed workload lost records.");
+  std::chrono::duration<double> time = end - start;
+  return thread_count * MIXED_OPERATIONS_PER_THREAD / time.count();
+}
+
+void benchmark_mixed_workload() {
+  std::cout << "Mixed workload (" << LOOKUP_KEYS << " keys loaded, "
+            << MIXED_OPERATIONS_PER_THREAD << " operations per thread, "
+            << default_thread_count() << " hardware threads)" << std::endl;
+  std::cout << std::setiosflags(std::ios::right);
+  std::cout << std::setw(16) << "Threads";
+  std::cout << std::setw(16) << "10% inserts";
+  std::cout << std::setw(16) << "50% inserts";
+  std::cout << std::setw(16) << "100% inserts";
+  std::cout << " (operations/s)" << std::endl;
+  for (int thread_count = 1;; thread_count *= 2) {
+    thread_count = std::min(thread_count, default_thread_count());
+    std::cout << std::setw(16) << thread_count;
+    for (int write_percent : {10, 50, 100})
+      std::cout << std::setw(16)
+                << (size_t)run_mixed_workload(thread_count, write_percent);
+    std::cout << std::endl;
+    if (thread_count == default_thread_count())
+      break;
+  }
+  std::cout << std::resetiosflags(std::ios::right);
+}
+
+struct GroupCommitResult {
+  double commits_per_second;
+  LogStats log;
+};
+
+// Commits COMMITS_PER_THREAD appends of a record and inserts of its key on
+// each of thread_count threads, then recovers the storage as after a crash
+// and checks that every insert is found.
+static GroupCommitResult run_group_commit(int thread_count) {
+  const std::string location = "data/bench_wal_";
+  GroupCommitResult result;
+  {
+    Storage storage(location, 0, 0, 0);
+    storage.enable_logging();
+    BPlusTree<uint32_t> tree(&storage,
+                             Node::max_record_count<uint32_t>(
+                                 storage.block_size));
+    tree.record_in_superblock();
+    storage.commit();
+    auto start = std::chrono::high_resolution_clock::now();
+    parallel_for(thread_count, [&](int thread) {
+      for (int i = 0; i < COMMITS_PER_THREAD; ++i) {
+        Record record{};
+        record.team_id_home = thread * COMMITS_PER_THREAD + i;
+        tree.insert(record.team_id_home, storage.append_record(record));
+        storage.commit();
+      }
+    });
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> time = end - start;
+    result.commits_per_second =
+        thread_count * COMMITS_PER_THREAD / time.count();
+    result.log = storage.log_stats();
+    // Dropped without flushing, as if the process had crashed.
+  }
+
+  auto storage = Storage::open(location);
+  storage.enable_logging();
+  auto tree = BPlusTree<uint32_t>::open(&storage);
+  size_t record_count = 0;
+  std::vector<RecordPointer> batch;
+  auto scan = tree->scan(0, UINT32_MAX);
+  while (scan.next(batch))
+    record_count += batch.size();
+  if (record_count != (size_t)thread_count * COMMITS_PER_THREAD ||
+      storage.data_block_count() == 0)
+    throw std::runtime_error("Recovery lost committed inserts.");
+  storage.flush_blocks();
+  return result;
+}
+
+void benchmark_group_commit() {
+  std::cout << "Group commit (" << COMMITS_PER_THREAD
+            << " commits per thread, each an append and an insert)"
+            << std::endl;
+  std::cout << std::setiosflags(std::ios::right);
+  std::cout << std::setw(16) << "Threads";
+  std::cout << std::setw(16) << "Commits/s";
+  std::cout << std::setw(16) << "Syncs";
+  std::cout << std::setw(16) << "Commits/sync" << std::endl;
+  // Committing threads mostly wait for syncs, so they are added beyond the
+  // hardware threads.
+  for (int thread_count : {1, 2, 4, 8}) {
+    auto result = run_group_commit(thread_count);
+    auto commits = (double)thread_count * COMMITS_PER_THREAD;
+    std::cout << std::setw(16) << thread_count;
+    std::cout << std::setw(16) << (size_t)result.commits_per_second;
+    std::cout << std::setw(16) << result.log.syncs;
+    std::cout << std::setw(16)
+              << commits / std::max<size_t>(result.log.syncs, 1) << std::endl;
+  }
+  std::cout << std::resetiosflags(std::ios::right);
+}
+
+static size_t blocks_written(const Storage &storage) {
+  return storage.data_block_stats().writes +
+         storage.index_block_stats().writes +
+         storage.overflow_block_stats().writes +
+         storage.hash_block_stats().writes;
+}
+
+struct StreamedInsertResult {
+  double flush_ms;
+  size_t flushed_blocks;
+  size_t written_behind;
+};
+
+static StreamedInsertResult run_streamed_inserts(bool background) {
+  Storage storage("data/bench_", 0, 0, 0);
+  BPlusTree<float> tree(&storage,
+                        Node::max_record_count<float>(storage.block_size));
+  load_lookup_keys(tree);
+  storage.flush_blocks();
+  if (background)
+    storage.start_background_writer();
+
+  std::mt19937 rng(42);
+  for (int batch = 0; batch < STREAMED_INSERT_BATCHES; ++batch) {
+    for (int i = 0; i < STREAMED_INSERTS_PER_BATCH; ++i) {
+      int k = rng() % LOOKUP_KEYS;
+      tree.insert((k + 0.5f) / LOOKUP_KEYS, {.block_id = k, .offset = 1});
+    }
+    std::this_thread::sleep_for(STREAMED_INSERT_PAUSE);
+  }
+  storage.stop_background_writer();
+
+  StreamedInsertResult result;
+  result.written_behind = storage.background_writer_stats().blocks_written;
+  auto written = blocks_written(storage);
+  auto start = std::chrono::high_resolution_clock::now();
+  storage.flush_blocks();
+  auto end = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<double, std::milli> time = end - start;
+  result.flush_ms = time.count();
+  result.flushed_blocks = blocks_written(storage) - written;
+  return result;
+}
+
+void benchmark_background_writer() {
+  std::cout << "Background writer (" << LOOKUP_KEYS << " keys loaded, "
+            << STREAMED_INSERT_BATCHES << " batches of "
+            << STREAMED_INSERTS_PER_BATCH << " inserts)" << std::endl;
+  std::cout << std::setiosflags(std::ios::right);
+  std::cout << std::setw(16) << "Writer";
+  std::cout << std::setw(16) << "Flush (ms)";
+  std::cout << std::setw(16) << "Flushed blocks";
+  std::cout << std::setw(16) << "Written behind" << std::endl;
+  for (bool background : {false, true}) {
+    auto result = run_streamed_inserts(background);
+    std::cout << std::setw(16) << (background ? "On" : "Off");
+    std::cout << std::setw(16) << result.flush_ms;
+    std::cout << std::setw(16) << result.flushed_blocks;
+    std::cout << std::setw(16) << result.written_behind << std::endl;
+  }
+  std::cout << std::resetiosflags(std::ios::right);
+}
@@ -0,0 +1,27 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+// Microbenchmarks, run with `--bench` after the tasks.
+
+// Compares the SIMD in-node key search with std::lower_bound across node
+// sizes.
+void benchmark_key_search();
+// Compares the SIMD range aggregate kernel with a scalar loop that branches on
+// the predicate.
+void benchmark_scan_kernel();
+// Measures point lookup throughput on a shared tree as reader threads are
+// added, with and without a thread inserting at the same time.
+void benchmark_concurrent_lookups();
+// Stress test with every thread both inserting and looking up keys. Checks
+// that no insert is lost and measures throughput as threads are added.
+void benchmark_mixed_workload();
+// Measures durable insert throughput with the write-ahead log as committing
+// threads are added, and how many commits share each sync. Then drops the
+// storage without flushing it and checks that recovery brings back every
+// committed insert.
+void benchmark_group_commit();
+// Compares the flush after a stream of inserts into a loaded tree with and
+// without the background writer cleaning blocks meanwhile.
+void benchmark_background_writer();
+
+#endif // BENCHMARK_H
@@ -1,97 +1,630 @@
 #include "bp_tree.h"
+#include "parallel.h"
 #include "storage/data_block.h"
 #include "storage/storage.h"
+#include <algorithm>
 #include <assert.h>
 #include <iostream>
 #include <queue>
+#include <stdexcept>
+#include <type_traits>
 #include <vector>
 
-void BPlusTree::insert(float key, RecordPointer value) {
-  auto optional_created_sibling = fetch_from_storage(this->storage, m_root)
-                                      ->insert(this->storage, key, value);
-  if (!optional_created_sibling.has_value())
+// Only trees of numeric keys are aggregated, which their constructor checks,
+// but every tree is compiled with the code maintaining aggregates.
+template <typename Key> static double aggregated_value(Key key) {
+  if constexpr (std::is_arithmetic_v<Key>)
+    return key;
+  else
+    throw std::logic_error("Only numeric keys are aggregated.");
+}
+
+template <typename Key> static KeyType key_type() {
+  if constexpr (std::is_same_v<Key, float>)
+    return KeyType::Float;
+  else if constexpr (std::is_same_v<Key, uint32_t>)
+    return KeyType::Uint32;
+  else
+    return KeyType::TeamDate;
+}
+
+template <typename Key> static KeyAggregate aggregate_of(const Node &node) {
+  if constexpr (std::is_arithmetic_v<Key>)
+    return node.subtree_aggregate<Key>();
+  else
+    throw std::logic_error("Only numeric keys are aggregated.");
+}
+
+template <typename Key>
+void BPlusTree<Key>::insert(Key key, RecordPointer value) {
+  auto operation = this->storage->begin_operation();
+  uint8_t included[MAX_PAYLOAD_SIZE];
+  DataBlockView block;
+  this->read_included(value, block, included);
+  if (this->m_aggregated || !this->insert_without_split(key, value, included))
+    this->insert_with_splits(key, value, included);
+};
+
+template <typename Key>
+void BPlusTree<Key>::read_included(RecordPointer record, DataBlockView &block,
+                                   uint8_t *out) const {
+  if (this->m_included.empty())
     return;
-  auto new_sibling = optional_created_sibling.value();
+  if (block.id() != record.block_id)
+    block = this->storage->get_data_block_view(record.block_id);
+  this->m_included.encode(block, record.offset, out);
+}
+
+template <typename Key>
+bool BPlusTree<Key>::insert_without_split(Key key, RecordPointer value,
+                                          const uint8_t *included) {
+  // Descend like a reader, but latch the leaf exclusively. Whether a node is
+  // a leaf never changes, so it can be checked before latching.
+  std::shared_lock<std::shared_mutex> root_lock(this->m_root_latch);
+  auto current = fetch_from_storage(this->storage, m_root);
+  std::shared_lock<std::shared_mutex> lock;
+  std::unique_lock<std::shared_mutex> leaf_lock;
+  if (current->is_leaf())
+    leaf_lock = std::unique_lock<std::shared_mutex>(current->latch());
+  else
+    lock = std::shared_lock<std::shared_mutex>(current->latch());
+  root_lock.unlock();
+  while (!current->is_leaf()) {
+    auto child =
+        current->child_node_at(this->storage, current->search_key(key));
+    if (child->is_leaf()) {
+      leaf_lock = std::unique_lock<std::shared_mutex>(child->latch());
+      lock.unlock();
+    } else {
+      lock = std::shared_lock<std::shared_mutex>(child->latch());
+    }
+    current = child;
+  }
+  if (!current->can_insert_without_split(key))
+    return false;
+  auto created_sibling = current->insert(this->storage, key, value, included);
+  assert(!created_sibling.has_value());
+  return true;
+}
+
+template <typename Key>
+void BPlusTree<Key>::insert_with_splits(Key key, RecordPointer value,
+                                        const uint8_t *included) {
+  // Latch crabbing: latch the path exclusively from the root down, releasing
+  // every latch above a node that has room, as a split cannot propagate past
+  // it. Only the nodes that split (and their parent) stay latched, or the
+  // whole path if the tree is aggregated.
+  struct LatchedNode {
+    NodeRef node;
+    std::unique_lock<std::shared_mutex> lock;
+  };
+  std::unique_lock<std::shared_mutex> root_lock(this->m_root_latch);
+  std::vector<LatchedNode> path;
+  auto latch = [&](NodeRef node) {
+    std::unique_lock<std::shared_mutex> lock(node->latch());
+    if (!this->m_aggregated && node->can_insert_without_split(key)) {
+      path.clear();
+      if (root_lock)
+        root_lock.unlock();
+    }
+    path.push_back({node, std::move(lock)});
+  };
+  latch(fetch_from_storage(this->storage, m_root));
+  while (!path.back().node->is_leaf()) {
+    const auto &parent = path.back().node;
+    latch(parent->child_node_at(this->storage, parent->search_key(key)));
+  }
+
+  // Siblings created by splitting the node at each level of the path.
+  std::vector<NodeRef> siblings(path.size());
+  auto created_sibling =
+      path.back().node->insert(this->storage, key, value, included);
+  for (int i = (int)path.size() - 1; i >= 0 && created_sibling; --i) {
+    siblings[i] = fetch_from_storage(this->storage, created_sibling->node);
+    if (i > 0)
+      created_sibling = path[i - 1].node->insert_child(
+          this->storage, created_sibling->key, created_sibling->node);
+  }
+  if (this->m_aggregated) {
+    // Refresh the aggregates of the nodes on the path and their new
+    // siblings, bottom-up, in whichever of the parent and its own new
+    // sibling now holds them.
+    for (int i = (int)path.size() - 2; i >= 0; --i) {
+      for (const auto &parent : {path[i].node, siblings[i]}) {
+        if (!parent)
+          continue;
+        for (size_t j = 0; j < parent->child_node_count(); ++j) {
+          auto id = parent->child_pointer_at(j).block_id;
+          for (const auto &child : {path[i + 1].node, siblings[i + 1]})
+            if (child && child->id == id)
+              parent->set_child_aggregate(j, aggregate_of<Key>(*child));
+        }
+        parent.mark_dirty();
+      }
+    }
+  }
+  if (!created_sibling.has_value())
+    return;
+  // Only an unsafe root splits, so its latch is still held.
+  assert(root_lock.owns_lock());
+  auto new_sibling = created_sibling.value();
   auto new_root = create_in_storage(
-      storage, new Node(m_degree, m_root, new_sibling.key, new_sibling.node));
-  m_root = new_root;
+      storage, new Node(m_degree, storage->block_size, m_root, new_sibling.key,
+                        new_sibling.node, this->m_aggregated));
+  if (this->m_aggregated) {
+    new_root->set_child_aggregate(0, aggregate_of<Key>(*path[0].node));
+    new_root->set_child_aggregate(1, aggregate_of<Key>(*siblings[0]));
+  }
+  m_root = NodePointer(new_root->id);
+  // The path went from the old root to a leaf.
+  this->save_root(path.size() + 1);
+}
+
+template <typename Key>
+void BPlusTree<Key>::bulk_load(std::vector<BulkLoadEntry<Key>> entries,
+                          double fill_factor, int thread_count) {
+  if (fill_factor <= 0 || fill_factor > 1)
+    throw std::invalid_argument("Fill factor must be in (0, 1].");
+  NodeRef root = fetch_from_storage(this->storage, m_root);
+  if (!root->is_leaf() || root->key_count() != 0)
+    throw std::logic_error("Bulk loading requires an empty tree.");
+  auto by_key = [](const BulkLoadEntry<Key> &a, const BulkLoadEntry<Key> &b) {
+    return a.key < b.key;
+  };
+  // Stable, so that records of the same key keep their original order.
+  if (!std::is_sorted(entries.begin(), entries.end(), by_key))
+    parallel_stable_sort(entries, by_key, thread_count);
+  if (entries.empty())
+    return;
+
+  // Split the entries into one run of leaves per thread. Runs hold a whole
+  // number of full leaves, so the leaves are packed as if built sequentially.
+  size_t leaf_capacity = std::max(1, (int)(m_degree * fill_factor));
+  std::vector<size_t> key_starts;
+  for (size_t i = 0; i < entries.size(); ++i)
+    if (i == 0 || entries[i].key != entries[i - 1].key)
+      key_starts.push_back(i);
+  auto leaf_count = ceil_div(key_starts.size(), leaf_capacity);
+  thread_count = std::max(1, std::min(thread_count, leaf_count));
+  size_t keys_per_run =
+      (size_t)ceil_div(leaf_count, thread_count) * leaf_capacity;
+  std::vector<size_t> bounds;
+  for (int i = 0; i < thread_count; ++i)
+    bounds.push_back(i * keys_per_run < key_starts.size()
+                         ? key_starts[i * keys_per_run]
+                         : entries.size());
+  bounds.push_back(entries.size());
+
+  // Allocate every leaf up front, in key order, so that the leaves of the
+  // runs take consecutive pages as in a sequential build. The first run
+  // starts with the empty root.
+  std::vector<std::vector<NodePointer>> run_leaves(thread_count);
+  run_leaves[0].push_back(NodePointer(root->id));
+  root = NodeRef();
+  for (int i = 0; i < thread_count; ++i) {
+    auto first_key = std::min(i * keys_per_run, key_starts.size());
+    auto last_key = std::min(first_key + keys_per_run, key_starts.size());
+    size_t count = ceil_div(last_key - first_key, leaf_capacity);
+    while (run_leaves[i].size() < count)
+      run_leaves[i].push_back(NodePointer(
+          create_in_storage(this->storage,
+                            new Node(m_degree, KeyCodec<Key>::SIZE,
+                                     this->m_included.size(),
+                                     this->storage->block_size))
+              ->id));
+  }
+
+  std::vector<Level> runs(thread_count);
+  parallel_for(thread_count, [&](int i) {
+    if (bounds[i] == bounds[i + 1])
+      return;
+    runs[i] = this->fill_leaves(entries, bounds[i], bounds[i + 1],
+                                run_leaves[i], leaf_capacity);
+  });
+
+  // Link the last leaf of each run to the first leaf of the next one.
+  Level level;
+  for (auto &run : runs) {
+    if (run.empty())
+      continue;
+    if (!level.empty()) {
+      NodeRef last = fetch_from_storage(this->storage, level.back().second);
+      last->set_next_node(run.front().second);
+      last.mark_dirty();
+    }
+    level.insert(level.end(), run.begin(), run.end());
+  }
+
+  // Build each internal level on top of the previous one. Children are spread
+  // evenly so that no internal node ends up with a single child.
+  size_t child_capacity = std::max(2, (int)((m_degree + 1) * fill_factor));
+  auto height = 1;
+  while (level.size() > 1) {
+    auto node_count = (level.size() + child_capacity - 1) / child_capacity;
+    node_count = std::min(node_count, level.size() / 2);
+    Level parents;
+    size_t next_child = 0;
+    for (size_t i = 0; i < node_count; ++i) {
+      auto end = level.size() * (i + 1) / node_count;
+      auto node = Node::create_empty_internal_node(
+          m_degree, KeyCodec<Key>::SIZE, this->storage->block_size,
+          this->m_aggregated);
+      for (auto j = next_child; j < end; ++j) {
+        node->bulk_append_child(level[j].first, level[j].second);
+        if (this->m_aggregated)
+          node->set_child_aggregate(
+              j - next_child,
+              aggregate_of<Key>(
+                  *fetch_from_storage(this->storage, level[j].second)));
+      }
+      auto node_ref = create_in_storage(this->storage, node);
+      parents.push_back({level[next_child].first, NodePointer(node_ref->id)});
+      next_child = end;
+    }
+    level = std::move(parents);
+    ++height;
+    assert(height < MAX_HEIGHT);
+  }
+  m_root = level[0].second;
+  this->save_root(height);
+}
+
+template <typename Key>
+typename BPlusTree<Key>::Level BPlusTree<Key>::fill_leaves(
+    const std::vector<BulkLoadEntry<Key>> &entries, size_t first, size_t last,
+    const std::vector<NodePointer> &leaves, size_t leaf_capacity) {
+  Level level;
+  NodeRef leaf = fetch_from_storage(this->storage, leaves.front());
+  level.push_back({entries[first].key, leaves.front()});
+  uint8_t included[MAX_PAYLOAD_SIZE];
+  DataBlockView block;
+  for (auto i = first; i < last; ++i) {
+    const auto &entry = entries[i];
+    auto key_count = leaf->key_count();
+    bool is_new_key =
+        key_count == 0 || leaf->key_at<Key>(key_count - 1) != entry.key;
+    if (is_new_key && key_count == leaf_capacity) {
+      assert(level.size() < leaves.size());
+      auto next = leaves[level.size()];
+      leaf->set_next_node(next);
+      leaf.mark_dirty();
+      leaf = fetch_from_storage(this->storage, next);
+      level.push_back({entry.key, next});
+    }
+    this->read_included(entry.record, block, included);
+    leaf->bulk_append(this->storage, entry.key, entry.record, included);
+  }
+  assert(level.size() == leaves.size());
+  return level;
+}
+
+template <typename Key>
+BPlusTree<Key>::BPlusTree(Storage *storage, int degree,
+                          IncludedColumns included, bool aggregated)
+    : storage(storage), m_degree(degree), m_included(std::move(included)),
+      m_aggregated(aggregated) {
+  if (aggregated && !std::is_arithmetic_v<Key>)
+    throw std::invalid_argument("Only numeric keys can be aggregated.");
+  auto root = new Node(degree, KeyCodec<Key>::SIZE, this->m_included.size(),
+                       storage->block_size);
+  this->m_root = NodePointer(create_in_storage(storage, root)->id);
+};
+
+template <typename Key>
+BPlusTree<Key>::BPlusTree(Storage *storage, int degree, NodePointer root,
+                          IncludedColumns included, bool aggregated)
+    : storage(storage), m_degree(degree), m_included(std::move(included)),
+      m_aggregated(aggregated), m_root(root) {
+  auto root_node = fetch_from_storage(storage, root);
+  if (!root_node->is_leaf() && root_node->has_aggregates() != aggregated)
+    throw std::invalid_argument("The tree was built with" +
+                                std::string(aggregated ? "out" : "") +
+                                " aggregates.");
 };
 
-BPlusTree::BPlusTree(Storage *storage, int degree)
-    : storage(storage), m_degree(degree) {
-  this->m_root = create_in_storage(storage, new Node(degree));
+template <typename Key>
+std::unique_ptr<BPlusTree<Key>> BPlusTree<Key>::open(Storage *storage,
+                                                     const std::string &name) {
+  auto info = storage->find_tree(name);
+  if (!info)
+    throw std::runtime_error("No tree named '" + name + "' in the storage.");
+  if (info->key_type != key_type<Key>())
+    throw std::invalid_argument("Tree '" + name +
+                                "' has keys of another type.");
+  auto tree = std::make_unique<BPlusTree>(
+      storage, info->degree, NodePointer(info->root),
+      IncludedColumns(info->included), info->aggregated);
+  tree->m_name = name;
+  return tree;
+}
+
+template <typename Key>
+void BPlusTree<Key>::record_in_superblock(const std::string &name) {
+  this->m_name = name;
+  this->save_root(this->get_height());
+}
+
+template <typename Key> void BPlusTree<Key>::save_root(int height) {
+  if (this->m_name.empty())
+    return;
+  this->storage->save_tree(
+      this->m_name, {.key_type = key_type<Key>(),
+                     .degree = this->m_degree,
+                     .root = this->m_root.block_id,
+                     .height = height,
+                     .aggregated = this->m_aggregated,
+                     .included = this->m_included.columns()});
+}
+
+template <typename Key>
+BPlusTree<Key>::Iterator::Iterator(const BPlusTree *tree, NodeRef leaf, Key key)
+    : m_current(leaf), m_index(0), m_key(key), m_vector_index(0),
+      m_tree(tree) {
+  this->seek(false);
 };
 
-BPlusTree::Iterator::Iterator(const BPlusTree *tree, Node *node, int index)
-    : m_current(node), m_index(index), m_vector_index(0), m_tree(tree) {};
+template <typename Key>
+void BPlusTree<Key>::Iterator::seek(bool past_key) {
+  auto resume = m_more_records;
+  auto last = resume ? m_records.back() : RecordPointer{0, 0};
+  m_records.clear();
+  m_more_records = false;
+  while (m_current) {
+    NodeRef next;
+    {
+      std::shared_lock<std::shared_mutex> lock(m_current->latch());
+      int count = m_current->leaf_entry_count();
+      m_index = m_current->search_key(m_key);
+      if (past_key && m_index < count &&
+          m_current->key_at<Key>(m_index) == m_key)
+        ++m_index;
+      if (m_index < count) {
+        auto cursor =
+            m_current->records_cursor(this->m_tree->storage, m_index);
+        RecordPointer record;
+        auto found = resume ? cursor.seek(last, record) : cursor.next(record);
+        if (resume) {
+          // Keys are never removed, so the key is still here. Records equal
+          // to the last one may already have been read.
+          assert(m_current->key_at<Key>(m_index) == m_key);
+          auto skipped = 0;
+          while (found && skipped < m_equal_records &&
+                 same_location(record, last)) {
+            found = cursor.next(record);
+            ++skipped;
+          }
+        } else {
+          m_key = m_current->key_at<Key>(m_index);
+        }
+        for (; found; found = cursor.next(record)) {
+          if (m_records.size() == ITERATOR_CHUNK_RECORDS) {
+            m_more_records = true;
+            break;
+          }
+          auto equal = (resume || !m_records.empty()) &&
+                       same_location(record, last);
+          m_equal_records = equal ? m_equal_records + 1 : 1;
+          m_records.push_back(record);
+          last = record;
+        }
+        return;
+      }
+      next = m_current->next_node(this->m_tree->storage);
+    }
+    m_current = next;
+  }
+  m_index = 0;
+  m_data_block = DataBlockView();
+}
 
-Record *BPlusTree::Iterator::record() const {
-  // TODO: Reconstructing vector every single time is very inefficient.
-  auto records = m_current->records_at(this->m_tree->storage, this->m_index);
-  assert(this->m_vector_index < records.size());
-  auto record_address = records[this->m_vector_index];
-  auto block = m_tree->storage->get_data_block(record_address.block_id);
-  return &block->records[record_address.offset];
+template <typename Key>
+RecordView BPlusTree<Key>::Iterator::record() const {
+  assert(this->m_vector_index < m_records.size());
+  auto record_address = m_records[this->m_vector_index];
+  if (m_data_block.id() != record_address.block_id)
+    m_data_block =
+        m_tree->storage->get_data_block_view(record_address.block_id);
+  return RecordView{.block = &m_data_block,
+                    .index = (size_t)record_address.offset};
 };
 
-BPlusTree::Iterator &BPlusTree::Iterator::operator++() {
-  if (m_current == nullptr)
+template <typename Key>
+typename BPlusTree<Key>::Iterator &BPlusTree<Key>::Iterator::operator++() {
+  if (!m_current)
     return *this;
   ++m_vector_index;
-  // TODO: Reconstructing vector every single time is very inefficient.
-  if (this->m_vector_index <
-      m_current->records_at(this->m_tree->storage, this->m_index).size())
+  if (this->m_vector_index < m_records.size())
     return *this;
-  // Advance index in leaf node.
+  // Advance to the next chunk, or the next key, which may be in the next leaf.
   m_vector_index = 0;
-  ++m_index;
-  if (this->m_index < m_current->leaf_entry_count())
-    return *this;
-  // Advance index block.
-  m_current = m_current->next_node(this->m_tree->storage);
-  m_index = 0;
+  this->seek(!m_more_records);
   return *this;
 };
 
-bool BPlusTree::Iterator::operator!=(const Iterator &other) const {
-  return m_current != other.m_current ||
+template <typename Key>
+bool BPlusTree<Key>::Iterator::operator!=(const Iterator &other) const {
+  return m_current.get() != other.m_current.get() ||
          m_vector_index != other.m_vector_index || m_index != other.m_index;
 };
 
-BPlusTree::Iterator BPlusTree::begin() const {
-  Node *current = fetch_from_storage(this->storage, this->m_root);
-  auto iteration_count = 0;
-  while (!current->is_leaf()) {
-    current = current->child_node_at(this->storage, 0);
-    ++iteration_count;
-    assert(iteration_count < MAX_HEIGHT);
-  }
-  return Iterator(this, current, 0);
+template <typename Key>
+typename BPlusTree<Key>::Iterator BPlusTree<Key>::begin() const {
+  auto lowest = KeyCodec<Key>::lowest();
+  return Iterator(this, this->find_leaf(lowest), lowest);
 }
 
-BPlusTree::Iterator BPlusTree::search(float key) const {
+template <typename Key>
+NodeRef BPlusTree<Key>::find_leaf(Key key) const {
+  std::shared_lock<std::shared_mutex> root_lock(this->m_root_latch);
   auto current = fetch_from_storage(this->storage, this->m_root);
+  std::shared_lock<std::shared_mutex> lock(current->latch());
+  root_lock.unlock();
   auto iteration_count = 0;
   while (!current->is_leaf()) {
     auto index = current->search_key(key);
-    assert(index == 0 || current->key_at(index - 1) <= key);
-    assert(index == current->key_count() || current->key_at(index) > key);
-    current = current->child_node_at(this->storage, index);
+    assert(index == 0 || !(key < current->key_at<Key>(index - 1)));
+    assert(index == current->key_count() || key < current->key_at<Key>(index));
+    auto child = current->child_node_at(this->storage, index);
+    // Latch the child before letting go of the parent, which unlatches before
+    // it is unpinned.
+    lock = std::shared_lock<std::shared_mutex>(child->latch());
+    current = child;
     ++iteration_count;
     assert(iteration_count < MAX_HEIGHT);
   }
-  return Iterator(this, current, current->search_key(key));
+  return current;
+}
+
+template <typename Key>
+typename BPlusTree<Key>::Iterator BPlusTree<Key>::search(Key key) const {
+  return Iterator(this, this->find_leaf(key), key);
 };
 
-BPlusTree::Iterator BPlusTree::end() const {
-  return Iterator(this, nullptr, 0);
+template <typename Key>
+typename BPlusTree<Key>::Iterator BPlusTree<Key>::end() const {
+  return Iterator(this, NodeRef(), Key{});
 };
 
-void BPlusTree::print() {
+template <typename Key>
+typename BPlusTree<Key>::RangeScan BPlusTree<Key>::scan(Key lo, Key hi) const {
+  auto leaf = this->find_leaf(lo);
+  {
+    std::shared_lock<std::shared_mutex> lock(leaf->latch());
+    this->storage->read_ahead_leaves(leaf->next_node_pointer());
+  }
+  return RangeScan(this, leaf, lo, hi);
+}
+
+template <typename Key>
+std::vector<RecordPointer> BPlusTree<Key>::scan_in_block_order(Key lo,
+                                                          Key hi) const {
+  std::vector<RecordPointer> records, batch;
+  auto range = this->scan(lo, hi);
+  while (range.next(batch))
+    records.insert(records.end(), batch.begin(), batch.end());
+  std::sort(records.begin(), records.end(), location_less);
+  records.erase(std::unique(records.begin(), records.end(), same_location),
+                records.end());
+  return records;
+}
+
+template <typename Key>
+KeyAggregate BPlusTree<Key>::range_aggregate(Key lo, Key hi) const {
+  if (!this->m_aggregated)
+    throw std::logic_error("The tree is not aggregated.");
+  std::shared_lock<std::shared_mutex> root_lock(this->m_root_latch);
+  auto root = fetch_from_storage(this->storage, this->m_root);
+  std::shared_lock<std::shared_mutex> lock(root->latch());
+  root_lock.unlock();
+  return this->aggregate_range(*root, &lo, &hi);
+}
+
+template <typename Key>
+KeyAggregate BPlusTree<Key>::aggregate_range(const Node &node, const Key *lo,
+                                             const Key *hi) const {
+  KeyAggregate aggregate;
+  if (node.is_leaf()) {
+    int count = node.leaf_entry_count();
+    for (int i = lo ? node.search_key(*lo) : 0; i < count; ++i) {
+      auto key = node.key_at<Key>(i);
+      if (hi && *hi < key)
+        break;
+      aggregate.merge(
+          KeyAggregate::of(aggregated_value(key), node.record_count_at(i)));
+    }
+    return aggregate;
+  }
+  // Children strictly between those holding the bounds are wholly in range.
+  int first = lo ? node.search_key(*lo) : 0;
+  int last = hi ? node.search_key(*hi) : node.child_node_count() - 1;
+  for (auto i = first; i <= last; ++i) {
+    auto child_lo = i == first ? lo : nullptr;
+    auto child_hi = i == last ? hi : nullptr;
+    if (!child_lo && !child_hi) {
+      aggregate.merge(node.child_aggregate(i));
+      continue;
+    }
+    auto child = node.child_node_at(this->storage, i);
+    std::shared_lock<std::shared_mutex> lock(child->latch());
+    aggregate.merge(this->aggregate_range(*child, child_lo, child_hi));
+  }
+  return aggregate;
+}
+
+template <typename Key>
+BPlusTree<Key>::RangeScan::RangeScan(const BPlusTree *tree, NodeRef leaf,
+                                     Key lo, Key hi)
+    : m_tree(tree), m_leaf(leaf), m_lo(lo), m_hi(hi) {};
+
+template <typename Key>
+template <typename ReadRange>
+bool BPlusTree<Key>::RangeScan::next_leaf(ReadRange read_range) {
+  // Leaves with no key in range (such as the first one when lo is past its
+  // last key) are skipped rather than returned as empty batches. Each leaf is
+  // read whole along with its next pointer, so entries a later split moves
+  // to a new sibling are not read twice: the sibling is skipped.
+  auto found = false;
+  while (m_leaf && !found) {
+    NodeRef next;
+    {
+      std::shared_lock<std::shared_mutex> lock(m_leaf->latch());
+      int count = m_leaf->leaf_entry_count();
+      int first = m_leaf->search_key(m_lo), last = first;
+      while (last < count && m_leaf->key_at<Key>(last) <= m_hi)
+        ++last;
+      read_range(*m_leaf, first, last);
+      found = first < last;
+      if (last == count)
+        next = m_leaf->next_node(m_tree->storage);
+    }
+    m_leaf = next;
+  }
+  return found;
+}
+
+template <typename Key>
+bool BPlusTree<Key>::RangeScan::next(std::vector<RecordPointer> &batch) {
+  batch.clear();
+  return this->next_leaf([&](const Node &leaf, int first, int last) {
+    // Posting lists know their length, so the batch is sized up front.
+    size_t record_count = 0;
+    for (auto index = first; index < last; ++index)
+      record_count += leaf.record_count_at(index);
+    batch.reserve(record_count);
+    for (auto index = first; index < last; ++index)
+      leaf.append_records_at(m_tree->storage, index, batch);
+  });
+}
+
+template <typename Key>
+bool BPlusTree<Key>::RangeScan::next(CoveredBatch<Key> &batch) {
+  batch.keys.clear();
+  batch.records.clear();
+  batch.included.clear();
+  batch.included_size = m_tree->m_included.size();
+  return this->next_leaf([&](const Node &leaf, int first, int last) {
+    assert(leaf.payload_size() == batch.included_size);
+    for (auto index = first; index < last; ++index) {
+      auto key = leaf.key_at<Key>(index);
+      auto cursor = leaf.records_cursor(m_tree->storage, index);
+      RecordPointer record;
+      while (cursor.next(record)) {
+        batch.keys.push_back(key);
+        batch.records.push_back(record);
+        batch.included.insert(batch.included.end(), cursor.payload(),
+                              cursor.payload() + batch.included_size);
+      }
+    }
+  });
+}
+
+template <typename Key>
+void BPlusTree<Key>::print() {
   print_node(fetch_from_storage(this->storage, this->m_root), 0);
 };
 
-void BPlusTree::print_node(Node *node, int level) {
+template <typename Key>
+void BPlusTree<Key>::print_node(NodeRef node, int level) {
   if (!node) {
     std::cout << "print_node on VOID!" << std::endl;
     return;
@@ -100,7 +633,7 @@ void BPlusTree::print_node(Node *node, int level) {
   std::cout << "Level " << level << ": ";
 
   for (int i = 0; i < node->key_count(); ++i) {
-    std::cout << "(" << node->key_at(i) << ") ";
+    std::cout << "(" << node->key_at<Key>(i) << ") ";
   }
 
   if (node->is_leaf()) {
@@ -113,8 +646,9 @@ void BPlusTree::print_node(Node *node, int level) {
   }
 };
 
-int BPlusTree::get_height() {
-  Node *current = fetch_from_storage(this->storage, this->m_root);
+template <typename Key>
+int BPlusTree<Key>::get_height() {
+  NodeRef current = fetch_from_storage(this->storage, this->m_root);
   int height = 1;
   while (!current->is_leaf()) {
     current = current->child_node_at(this->storage, 0);
@@ -124,26 +658,32 @@ int BPlusTree::get_height() {
   return height;
 };
 
-std::vector<float> BPlusTree::get_root_keys() {
+template <typename Key>
+std::vector<Key> BPlusTree<Key>::get_root_keys() {
   auto root = fetch_from_storage(this->storage, this->m_root);
-  std::vector<float> keys;
+  std::vector<Key> keys;
   for (int i = 0; i < root->key_count(); i++)
-    keys.push_back(root->key_at(i));
+    keys.push_back(root->key_at<Key>(i));
   return keys;
 };
 
-int BPlusTree::get_number_of_nodes() {
+template <typename Key>
+int BPlusTree<Key>::get_number_of_nodes() {
   int count = 0;
-  std::queue<Node *> nodes_to_visit;
-  nodes_to_visit.push(fetch_from_storage(this->storage, this->m_root));
+  std::queue<NodePointer> nodes_to_visit;
+  nodes_to_visit.push(this->m_root);
   while (!nodes_to_visit.empty()) {
     ++count;
-    Node *current = nodes_to_visit.front();
+    NodeRef current = fetch_from_storage(this->storage, nodes_to_visit.front());
     nodes_to_visit.pop();
     if (current->is_leaf())
       continue; // We're done with this node!
     for (auto i = 0; i < current->child_node_count(); i++)
-      nodes_to_visit.push(current->child_node_at(this->storage, i));
+      nodes_to_visit.push(current->child_pointer_at(i));
   }
   return count;
 };
+
+template class BPlusTree<float>;
+template class BPlusTree<uint32_t>;
+template class BPlusTree<TeamDateKey>;
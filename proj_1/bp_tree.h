@@ -1,54 +1,224 @@
 #ifndef BP_TREE_H
 #define BP_TREE_H
 
+#include "included_columns.h"
 #include "node.h"
 #include "storage/storage.h"
+#include <memory>
+#include <shared_mutex>
+#include <string>
 
-const int KEY_SIZE = 4;
 const int MAX_HEIGHT = 20;
+const double DEFAULT_FILL_FACTOR = 1.0;
+// Name of a tree in the superblock unless given another.
+const char *const DEFAULT_TREE_NAME = "primary";
+// Records an iterator reads from a posting list at a time.
+const int ITERATOR_CHUNK_RECORDS = 1024;
 
-int ceil_div(int a, int b);
-int floor_div(int a, int b);
+template <typename Key> struct BulkLoadEntry {
+  Key key;
+  RecordPointer record;
+};
+
+// Records of a key range read from the leaves alone, along with their keys
+// and included columns, for queries that need nothing else.
+template <typename Key> struct CoveredBatch {
+  std::vector<Key> keys;
+  std::vector<RecordPointer> records;
+  // Included column values of each record, included_size bytes apiece.
+  std::vector<uint8_t> included;
+  size_t included_size = 0;
+
+  size_t size() const { return this->records.size(); };
+  const uint8_t *included_at(size_t i) const {
+    return this->included.data() + i * this->included_size;
+  };
+};
 
-class BPlusTree {
+// Lookups, scans and inserts may run concurrently from any number of threads.
+// Readers couple shared node latches from the root down and latch each leaf
+// only while reading it, finding their place again by key, so they tolerate
+// entries shifting or moving to a new sibling in between. Inserts descend the
+// same way and latch only the leaf exclusively, unless it is full, in which
+// case they retry with latch crabbing. Bulk loading and the statistics
+// functions expect exclusive use of the tree.
+//
+// Keys are of type Key, laid out and searched as its KeyCodec describes. The
+// tree is instantiated in bp_tree.cpp for the key types of our indexes: float
+// (fg_pct_home), uint32_t (game_date_est or team_id_home) and TeamDateKey.
+//
+// A covering index also stores the values of its included columns with each
+// record, read from the data blocks as records are inserted.
+//
+// An aggregated tree, of numeric keys, keeps in its internal nodes the
+// aggregate of the keys below each child, so that range_aggregate only reads
+// the two paths to the bounds of the range. As every insert then changes its
+// whole path, inserts latch the path exclusively from the root.
+template <typename Key> class BPlusTree {
 public:
-  BPlusTree(Storage *storage, int degree);
+  BPlusTree(Storage *storage, int degree, IncludedColumns included = {},
+            bool aggregated = false);
+  // Attach to a tree that already exists in storage, which was created with
+  // the same included columns and aggregation.
+  BPlusTree(Storage *storage, int degree, NodePointer root,
+            IncludedColumns included = {}, bool aggregated = false);
+  // Opens the tree recorded in the superblock of storage under name, with
+  // the degree, included columns and aggregation it was built with. Throws
+  // if there is none or its keys are not of type Key.
+  static std::unique_ptr<BPlusTree>
+  open(Storage *storage, const std::string &name = DEFAULT_TREE_NAME);
 
   class Iterator {
   public:
-    Iterator(const BPlusTree *tree, Node *node, int index);
+    // Starts at the first key >= key in leaf or a leaf after it.
+    Iterator(const BPlusTree *tree, NodeRef leaf, Key key);
 
-    Record &operator*() const { return *record(); };
-    Record *operator->() const { return record(); };
+    // Records are read in place from their data block. A RecordView is only
+    // valid until the iterator moves on.
+    RecordView operator*() const { return record(); };
+    const RecordView *operator->() const {
+      m_record = record();
+      return &m_record;
+    };
     Iterator &operator++();
     bool operator!=(const Iterator &other) const;
 
   private:
-    Record *record() const;
+    RecordView record() const;
+    // Moves to the first key >= m_key, or > m_key once its records have been
+    // read, following the leaf chain, and reads the first chunk of its
+    // records. If the last chunk read did not reach the end of the posting
+    // list, reads the next chunk of the same key instead, seeking past the
+    // records already read.
+    void seek(bool past_key);
 
-    Node *m_current;
+    NodeRef m_current;
     int m_index;
+    Key m_key;
     int m_vector_index;
     const BPlusTree *m_tree;
+    // Chunk of the records of the key at m_index.
+    std::vector<RecordPointer> m_records;
+    // Whether the key has records after the chunk, which then resume after
+    // the last record read, once again past m_equal_records records equal to
+    // it as a posting list may hold duplicates.
+    bool m_more_records = false;
+    int m_equal_records = 0;
+    // Data block of the last record returned, kept pinned while in use.
+    mutable DataBlockView m_data_block;
+    mutable RecordView m_record;
+  };
+
+  // Streams the records of a key range one leaf at a time, reading each key's
+  // records (and overflow chain) exactly once.
+  class RangeScan {
+  public:
+    RangeScan(const BPlusTree *tree, NodeRef leaf, Key lo, Key hi);
+
+    // Replaces the contents of batch with the records of the next leaf that
+    // are in range. Returns false once the range is exhausted.
+    bool next(std::vector<RecordPointer> &batch);
+    // Same, along with the key and included columns of each record, so that
+    // the scan is answered from the index alone.
+    bool next(CoveredBatch<Key> &batch);
+
+  private:
+    // Latches the next leaf with keys in range and calls read_range with it
+    // and the range [first, last) of its entries in range. Returns false once
+    // the range is exhausted.
+    template <typename ReadRange> bool next_leaf(ReadRange read_range);
+
+    const BPlusTree *m_tree;
+    NodeRef m_leaf;
+    Key m_lo;
+    Key m_hi;
   };
 
   Iterator begin() const;
-  Iterator search(float key) const;
+  Iterator search(Key key) const;
   Iterator end() const;
+  // Records with keys in [lo, hi], in key order.
+  RangeScan scan(Key lo, Key hi) const;
+  // Records with keys in [lo, hi], sorted by data block and offset without
+  // duplicates, so that every data block is visited once and in file order.
+  std::vector<RecordPointer> scan_in_block_order(Key lo, Key hi) const;
+  // COUNT, SUM, MIN and MAX of the keys of the records with keys in
+  // [lo, hi], reading only the nodes on the paths to lo and hi. The tree must
+  // be aggregated.
+  KeyAggregate range_aggregate(Key lo, Key hi) const;
 
-  void insert(float key, RecordPointer value);
+  void insert(Key key, RecordPointer value);
+  // Builds the tree bottom-up from the given entries, sorting them first if
+  // needed. Nodes are packed to the fill factor and allocated level by level,
+  // so pages are written sequentially. The tree must be empty.
+  //
+  // With more than one thread, the entries are sorted in parallel and split
+  // into one key range per thread. Each thread fills its own run of leaves,
+  // and the runs are then linked and indexed by the internal levels.
+  void bulk_load(std::vector<BulkLoadEntry<Key>> entries,
+                 double fill_factor = DEFAULT_FILL_FACTOR,
+                 int thread_count = 1);
   void print();
-  void print_node(Node *node, int level);
+  void print_node(NodeRef node, int level);
+  // Records the tree in the superblock under name, and from then on its
+  // root and height whenever the root moves, so that open finds it after a
+  // restart. Expects exclusive use of the tree.
+  void record_in_superblock(const std::string &name = DEFAULT_TREE_NAME);
   int get_degree() { return this->m_degree; };
+  NodePointer root() const { return this->m_root; };
+  const IncludedColumns &included_columns() const { return this->m_included; };
+  bool aggregated() const { return this->m_aggregated; };
   int get_height();
-  std::vector<float> get_root_keys();
+  std::vector<Key> get_root_keys();
   int get_number_of_nodes();
 
   Storage *storage = nullptr;
 
 private:
+  // Inserts into a leaf with room, latching only that leaf exclusively.
+  // Returns false without inserting if the leaf would split.
+  bool insert_without_split(Key key, RecordPointer value,
+                            const uint8_t *included);
+  // Inserts with exclusive latches on the nodes that may split.
+  void insert_with_splits(Key key, RecordPointer value,
+                          const uint8_t *included);
+  // Writes the included column values of record into out, reading its data
+  // block through block unless that already holds it.
+  void read_included(RecordPointer record, DataBlockView &block,
+                     uint8_t *out) const;
+  // Leaf in which key is, or would be inserted. The leaf is unlatched when
+  // returned, so a concurrent split may since have moved the key further
+  // along the leaf chain.
+  NodeRef find_leaf(Key key) const;
+  // Aggregate of the records below node, which the caller keeps latched, with
+  // keys not before *lo and not after *hi. A null bound leaves that side
+  // unbounded. Only children holding a bound are descended into.
+  KeyAggregate aggregate_range(const Node &node, const Key *lo,
+                               const Key *hi) const;
+
+  // Records the current root in the superblock, if the tree is in it.
+  void save_root(int height);
+
+  using Level = std::vector<std::pair<Key, NodePointer>>;
+  // Appends entries [first, last) to the given empty leaves, in order,
+  // returning the first key and pointer of each of those leaves.
+  Level fill_leaves(const std::vector<BulkLoadEntry<Key>> &entries,
+                    size_t first, size_t last,
+                    const std::vector<NodePointer> &leaves,
+                    size_t leaf_capacity);
+
   int m_degree = 0;
+  IncludedColumns m_included;
+  bool m_aggregated = false;
+  // Guards m_root, which changes when the root splits.
+  mutable std::shared_mutex m_root_latch;
   NodePointer m_root;
+  // Name in the superblock, or empty.
+  std::string m_name;
 };
 
+extern template class BPlusTree<float>;
+extern template class BPlusTree<uint32_t>;
+extern template class BPlusTree<TeamDateKey>;
+
 #endif // BP_TREE_H
@@ -0,0 +1,289 @@
+#include "hash_index.h"
+#include <algorithm>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+
+// Finalizer of MurmurHash3. It is a bijection, so distinct keys always differ
+// in some bit of their hash, and it spreads consecutive values such as dates
+// over every bit.
+static uint32_t hash_key(uint32_t key) {
+  key ^= key >> 16;
+  key *= 0x85ebca6b;
+  key ^= key >> 13;
+  key *= 0xc2b2ae35;
+  key ^= key >> 16;
+  return key;
+}
+
+static uint32_t low_bits(uint32_t hash, int depth) {
+  return depth == 0 ? 0 : hash & (UINT32_MAX >> (32 - depth));
+}
+
+HashPage::HashPage(size_t page_size, bool is_bucket, int depth)
+    : m_page(new char[page_size]{}), m_page_size(page_size) {
+  assert(depth >= 0 && depth <= MAX_HASH_DEPTH);
+  this->m_header = reinterpret_cast<HashPageHeader *>(this->m_page);
+  this->m_header->is_bucket = is_bucket;
+  this->m_header->depth = depth;
+  this->m_header->size = 0;
+  this->m_header->next = -1;
+}
+
+HashPage *HashPage::create_bucket(size_t page_size, int depth) {
+  return new HashPage(page_size, true, depth);
+}
+
+HashPage *HashPage::create_directory(size_t page_size) {
+  return new HashPage(page_size, false, 0);
+}
+
+HashPage::~HashPage() { delete[] m_page; };
+
+HashPage::HashPage(int block_id, const PagedFile &file)
+    : id(block_id), m_page(new char[file.page_size()]),
+      m_page_size(file.page_size()) {
+  file.read_page(block_id, this->m_page);
+  this->m_header = reinterpret_cast<HashPageHeader *>(this->m_page);
+  if (this->m_header->is_bucket > 1 ||
+      this->m_header->depth > MAX_HASH_DEPTH ||
+      this->m_header->size > this->capacity())
+    throw std::runtime_error("Corrupted hash index page " +
+                             std::to_string(block_id) + ".");
+}
+
+size_t HashPage::bucket_capacity(size_t page_size) {
+  return (page_size - sizeof(HashPageHeader)) / sizeof(HashEntry);
+}
+
+size_t HashPage::directory_capacity(size_t page_size) {
+  return (page_size - sizeof(HashPageHeader)) / sizeof(int32_t);
+}
+
+size_t HashPage::capacity() const {
+  return this->is_bucket() ? bucket_capacity(this->m_page_size)
+                           : directory_capacity(this->m_page_size);
+}
+
+HashEntry *HashPage::entries() const {
+  assert(this->is_bucket());
+  static_assert(sizeof(HashPageHeader) % alignof(HashEntry) == 0,
+                "Entries must be aligned.");
+  return reinterpret_cast<HashEntry *>(this->m_page + sizeof(HashPageHeader));
+}
+
+int32_t *HashPage::slots() const {
+  assert(!this->is_bucket());
+  return reinterpret_cast<int32_t *>(this->m_page + sizeof(HashPageHeader));
+}
+
+void HashPage::set_depth(int depth) {
+  assert(depth >= 0 && depth <= MAX_HASH_DEPTH);
+  this->m_header->depth = depth;
+}
+
+HashEntry *HashPage::find(uint32_t key) const {
+  auto entries = this->entries();
+  auto end = entries + this->m_header->size;
+  auto it = std::find_if(entries, end,
+                         [key](const HashEntry &e) { return e.key == key; });
+  return it == end ? nullptr : it;
+}
+
+HashEntry &HashPage::entry_at(size_t index) const {
+  assert(index < this->m_header->size);
+  return this->entries()[index];
+}
+
+bool HashPage::full() const { return this->size() == this->capacity(); }
+
+HashEntry &HashPage::append(uint32_t key) {
+  assert(!this->full());
+  auto &entry = this->entries()[this->m_header->size++];
+  entry.key = key;
+  entry.records.clear(0);
+  return entry;
+}
+
+int32_t HashPage::slot_at(size_t index) const {
+  assert(index < this->m_header->size);
+  return this->slots()[index];
+}
+
+void HashPage::set_slots(const int32_t *slots, size_t count) {
+  assert(count <= this->capacity());
+  std::copy(slots, slots + count, this->slots());
+  this->m_header->size = count;
+}
+
+HashIndex::HashIndex(Storage *storage, Column column)
+    : m_storage(storage), m_column(column) {
+  if (!column_holds<uint32_t>(column))
+    throw std::invalid_argument("Hash indexes need a uint32_t column.");
+  auto bucket = storage->track_new_hash_block(
+      HashPage::create_bucket(storage->block_size, 0));
+  this->m_slots.push_back(bucket->id);
+  this->save_directory();
+}
+
+HashIndex::HashIndex(Storage *storage, Column column, int directory)
+    : m_storage(storage), m_column(column) {
+  if (!column_holds<uint32_t>(column))
+    throw std::invalid_argument("Hash indexes need a uint32_t column.");
+  for (auto id = directory; id >= 0;) {
+    auto page = storage->get_hash_block(id);
+    if (page->is_bucket())
+      throw std::runtime_error("Hash index page " + std::to_string(id) +
+                               " is not a directory page.");
+    if (id == directory)
+      this->m_global_depth = page->depth();
+    for (size_t i = 0; i < page->size(); ++i)
+      this->m_slots.push_back(page->slot_at(i));
+    this->m_directory_pages.push_back(id);
+    id = page->next();
+  }
+  if (this->m_slots.size() != (size_t)1 << this->m_global_depth)
+    throw std::runtime_error("Hash index directory is truncated.");
+}
+
+std::unique_ptr<HashIndex> HashIndex::open(Storage *storage,
+                                           const std::string &name) {
+  auto info = storage->find_hash_index(name);
+  if (!info)
+    throw std::runtime_error("No hash index named '" + name +
+                             "' in the storage.");
+  return std::make_unique<HashIndex>(storage, info->column, info->directory);
+}
+
+void HashIndex::record_in_superblock(const std::string &name) {
+  this->m_storage->save_hash_index(
+      name, {.column = this->m_column, .directory = this->directory()});
+}
+
+int HashIndex::global_depth() const {
+  std::shared_lock<std::shared_mutex> lock(this->m_latch);
+  return this->m_global_depth;
+}
+
+size_t HashIndex::bucket_count() const {
+  std::shared_lock<std::shared_mutex> lock(this->m_latch);
+  return std::set<int32_t>(this->m_slots.begin(), this->m_slots.end()).size();
+}
+
+BlockRef<HashPage> HashIndex::bucket_of(uint32_t key) const {
+  auto slot = low_bits(hash_key(key), this->m_global_depth);
+  return this->m_storage->get_hash_block(this->m_slots[slot]);
+}
+
+void HashIndex::insert(uint32_t key, RecordPointer record) {
+  auto operation = this->m_storage->begin_operation();
+  std::unique_lock<std::shared_mutex> lock(this->m_latch);
+  while (true) {
+    auto bucket = this->bucket_of(key);
+    auto entry = bucket->find(key);
+    if (!entry && !bucket->full())
+      entry = &bucket->append(key);
+    if (entry) {
+      entry->records.insert(this->m_storage, record, nullptr);
+      this->m_storage->mark_hash_block_dirty(bucket->id);
+      return;
+    }
+    this->split(key, bucket);
+  }
+}
+
+void HashIndex::split(uint32_t key, const BlockRef<HashPage> &bucket) {
+  auto depth = bucket->depth();
+  if (depth == this->m_global_depth) {
+    if (depth == MAX_HASH_DEPTH)
+      throw std::runtime_error("Hash index directory cannot grow further.");
+    // Slot i + 2^depth starts out pointing where slot i does.
+    auto slot_count = this->m_slots.size();
+    this->m_slots.resize(2 * slot_count);
+    std::copy_n(this->m_slots.begin(), slot_count,
+                this->m_slots.begin() + slot_count);
+    ++this->m_global_depth;
+  }
+
+  // Keys whose hash has bit depth set move to the new bucket.
+  auto sibling = this->m_storage->track_new_hash_block(
+      HashPage::create_bucket(this->m_storage->block_size, depth + 1));
+  std::vector<HashEntry> entries;
+  for (size_t i = 0; i < bucket->size(); ++i)
+    entries.push_back(bucket->entry_at(i));
+  bucket->clear_entries();
+  bucket->set_depth(depth + 1);
+  for (const auto &entry : entries) {
+    auto target = (hash_key(entry.key) >> depth) & 1 ? sibling.get()
+                                                      : bucket.get();
+    target->append(entry.key) = entry;
+  }
+  this->m_storage->mark_hash_block_dirty(bucket->id);
+
+  auto prefix = low_bits(hash_key(key), depth) | (1u << depth);
+  for (size_t slot = 0; slot < this->m_slots.size(); ++slot)
+    if (low_bits(slot, depth + 1) == prefix)
+      this->m_slots[slot] = sibling->id;
+  this->save_directory();
+}
+
+void HashIndex::save_directory() {
+  auto capacity = HashPage::directory_capacity(this->m_storage->block_size);
+  auto page_count = std::max<size_t>(
+      1, (this->m_slots.size() + capacity - 1) / capacity);
+  BlockRef<HashPage> previous;
+  for (size_t i = 0; i < page_count; ++i) {
+    BlockRef<HashPage> page;
+    if (i < this->m_directory_pages.size()) {
+      page = this->m_storage->get_hash_block(this->m_directory_pages[i]);
+      this->m_storage->mark_hash_block_dirty(page->id);
+    } else {
+      page = this->m_storage->track_new_hash_block(
+          HashPage::create_directory(this->m_storage->block_size));
+      this->m_directory_pages.push_back(page->id);
+      if (previous) {
+        previous->set_next(page->id);
+        this->m_storage->mark_hash_block_dirty(previous->id);
+      }
+    }
+    auto first = i * capacity;
+    auto count = std::min(capacity, this->m_slots.size() - first);
+    page->set_slots(this->m_slots.data() + first, count);
+    if (i == 0)
+      page->set_depth(this->m_global_depth);
+    previous = page;
+  }
+}
+
+void HashIndex::insert_data_blocks() {
+  std::vector<uint32_t> buffer;
+  for (int i = 0; i < this->m_storage->data_block_count(); ++i) {
+    this->m_storage->read_ahead_data_blocks(i);
+    auto block = this->m_storage->get_data_block_view(i);
+    auto values = block.column(this->m_column, buffer);
+    for (size_t j = 0; j < block.size(); ++j)
+      this->insert(values[j], {.block_id = i, .offset = (int)j});
+  }
+}
+
+std::vector<RecordPointer> HashIndex::lookup(uint32_t key) const {
+  std::shared_lock<std::shared_mutex> lock(this->m_latch);
+  std::vector<RecordPointer> records;
+  auto bucket = this->bucket_of(key);
+  auto entry = bucket->find(key);
+  if (!entry)
+    return records;
+  records.reserve(entry->records.count);
+  PostingCursor cursor(this->m_storage, entry->records);
+  RecordPointer record;
+  while (cursor.next(record))
+    records.push_back(record);
+  return records;
+}
+
+size_t HashIndex::count(uint32_t key) const {
+  std::shared_lock<std::shared_mutex> lock(this->m_latch);
+  auto bucket = this->bucket_of(key);
+  auto entry = bucket->find(key);
+  return entry ? entry->records.count : 0;
+}
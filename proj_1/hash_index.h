@@ -0,0 +1,149 @@
+#ifndef HASH_INDEX_H
+#define HASH_INDEX_H
+
+#include "node.h"
+#include "storage/storage.h"
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+// Deepest the directory may grow, which bounds it to 2^24 slots.
+constexpr int MAX_HASH_DEPTH = 24;
+
+// Header at the start of every hash index page.
+struct HashPageHeader {
+  uint8_t is_bucket;
+  // Bits of the hash shared by every key of a bucket (its local depth), or
+  // the global depth of the directory on its first page.
+  uint8_t depth;
+  // Entries of a bucket or slots of a directory page.
+  uint16_t size;
+  // Next directory page, or -1. Unused for buckets.
+  int32_t next;
+  int32_t reserved[2];
+};
+static_assert(sizeof(HashPageHeader) == 16,
+              "HashPageHeader must be 16 bytes.");
+
+// A key of a bucket and the posting list of its records, which goes on in
+// overflow pages as for a leaf entry.
+struct HashEntry {
+  uint32_t key;
+  NodeRecords records;
+};
+static_assert(std::is_trivially_copyable_v<HashEntry>,
+              "HashEntry must be stored in pages as-is.");
+
+// A hash index page, stored as a fixed layout page used in memory as-is:
+//   HashPageHeader | HashEntry entries[]   for buckets
+//   HashPageHeader | int32_t slots[]       for directory pages
+// where each directory slot is the id of a bucket page.
+class HashPage {
+public:
+  static HashPage *create_bucket(size_t page_size, int depth);
+  static HashPage *create_directory(size_t page_size);
+  ~HashPage();
+
+  HashPage(const HashPage &) = delete;
+  HashPage &operator=(const HashPage &) = delete;
+
+  // Read the page from the file.
+  HashPage(int block_id, const PagedFile &file);
+
+  static constexpr bool FIXED_LAYOUT = true;
+  const char *page_data() const { return this->m_page; };
+  size_t page_size() const { return this->m_page_size; };
+
+  int id = -1;
+
+  static size_t bucket_capacity(size_t page_size);
+  static size_t directory_capacity(size_t page_size);
+
+  bool is_bucket() const { return this->m_header->is_bucket; };
+  int depth() const { return this->m_header->depth; };
+  void set_depth(int depth);
+  size_t size() const { return this->m_header->size; };
+
+  // Entry of key in this bucket, or null.
+  HashEntry *find(uint32_t key) const;
+  HashEntry &entry_at(size_t index) const;
+  bool full() const;
+  // Adds an entry for key without records. The bucket must not be full.
+  HashEntry &append(uint32_t key);
+  // Removes every entry, leaving their posting lists to whoever copied them.
+  void clear_entries() { this->m_header->size = 0; };
+
+  int32_t slot_at(size_t index) const;
+  // Replaces the slots of a directory page.
+  void set_slots(const int32_t *slots, size_t count);
+  int next() const { return this->m_header->next; };
+  void set_next(int next) { this->m_header->next = next; };
+
+private:
+  HashPage(size_t page_size, bool is_bucket, int depth);
+  size_t capacity() const;
+  HashEntry *entries() const;
+  int32_t *slots() const;
+
+  char *m_page;
+  size_t m_page_size;
+  HashPageHeader *m_header;
+};
+
+// Extendible hash index from the values of a uint32_t column (team_id_home or
+// game_date_est) to the records holding them, for exact-match lookups.
+//
+// The directory holds 2^global_depth slots, each the bucket page of the keys
+// whose hash ends in the slot's bits. It is kept in memory and mirrored to a
+// chain of directory pages, so a lookup reads a single bucket page, plus the
+// overflow pages of a key with more records than fit in its entry. A full
+// bucket splits on the next bit of the hash, doubling the directory first if
+// the bucket already uses all of its bits.
+//
+// Lookups may run concurrently with each other. Inserts take the whole index
+// exclusively.
+class HashIndex {
+public:
+  // Creates an empty index on column, which must hold uint32_t values.
+  HashIndex(Storage *storage, Column column);
+  // Attaches to an index that already exists in storage, given its first
+  // directory page.
+  HashIndex(Storage *storage, Column column, int directory);
+  // Opens the index recorded in the superblock of storage under name.
+  static std::unique_ptr<HashIndex> open(Storage *storage,
+                                         const std::string &name);
+  // Records the index in the superblock under name, so that open finds it
+  // after a restart. Its first directory page never moves.
+  void record_in_superblock(const std::string &name);
+
+  Column column() const { return this->m_column; };
+  // First directory page, from which the index can be attached again.
+  int directory() const { return this->m_directory_pages.front(); };
+  int global_depth() const;
+  size_t bucket_count() const;
+
+  void insert(uint32_t key, RecordPointer record);
+  // Inserts every record of the data blocks.
+  void insert_data_blocks();
+
+  std::vector<RecordPointer> lookup(uint32_t key) const;
+  size_t count(uint32_t key) const;
+
+private:
+  BlockRef<HashPage> bucket_of(uint32_t key) const;
+  // Splits the full bucket that key hashes to.
+  void split(uint32_t key, const BlockRef<HashPage> &bucket);
+  // Writes the directory to its pages, adding pages as it grows.
+  void save_directory();
+
+  Storage *m_storage;
+  Column m_column;
+  int m_global_depth = 0;
+  std::vector<int32_t> m_slots;
+  std::vector<int> m_directory_pages;
+  mutable std::shared_mutex m_latch;
+};
+
+#endif // HASH_INDEX_H
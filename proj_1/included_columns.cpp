@@ -0,0 +1,106 @@
+#include "included_columns.h"
+#include "posting_list.h"
+#include <algorithm>
+#include <stdexcept>
+
+static size_t column_width(Column column) {
+  switch (column) {
+  case Column::AstHome:
+  case Column::RebHome:
+  case Column::PtsHome:
+    return sizeof(uint16_t);
+  case Column::HomeTeamWins:
+    return sizeof(uint8_t);
+  default:
+    return sizeof(uint32_t);
+  }
+}
+
+IncludedColumns::IncludedColumns(std::vector<Column> columns)
+    : m_columns(std::move(columns)) {
+  for (auto column : this->m_columns) {
+    if (std::count(this->m_columns.begin(), this->m_columns.end(), column) > 1)
+      throw std::invalid_argument("Included columns must be distinct.");
+    this->m_offsets.push_back(this->m_size);
+    this->m_size += column_width(column);
+  }
+  if (this->m_size > MAX_PAYLOAD_SIZE)
+    throw std::invalid_argument("Included columns take more than " +
+                                std::to_string(MAX_PAYLOAD_SIZE) +
+                                " bytes per record.");
+}
+
+bool IncludedColumns::contains(Column column) const {
+  return std::find(this->m_columns.begin(), this->m_columns.end(), column) !=
+         this->m_columns.end();
+}
+
+size_t IncludedColumns::offset_of(Column column) const {
+  auto it = std::find(this->m_columns.begin(), this->m_columns.end(), column);
+  if (it == this->m_columns.end())
+    throw std::invalid_argument("Column is not included in the index.");
+  return this->m_offsets[it - this->m_columns.begin()];
+}
+
+// Copies value into out, returning the end of the copy.
+template <typename T> static uint8_t *store(uint8_t *out, T value) {
+  std::memcpy(out, &value, sizeof(T));
+  return out + sizeof(T);
+}
+
+void IncludedColumns::encode(const DataBlockView &block, size_t index,
+                             uint8_t *out) const {
+  for (auto column : this->m_columns) {
+    switch (column) {
+    case Column::GameDateEst:
+      out = store(out, block.game_date_est(index));
+      break;
+    case Column::TeamIdHome:
+      out = store(out, block.team_id_home(index));
+      break;
+    case Column::FgPctHome:
+      out = store(out, block.fg_pct_home(index));
+      break;
+    case Column::FtPctHome:
+      out = store(out, block.ft_pct_home(index));
+      break;
+    case Column::Fg3PctHome:
+      out = store(out, block.fg3_pct_home(index));
+      break;
+    case Column::AstHome:
+      out = store(out, block.ast_home(index));
+      break;
+    case Column::RebHome:
+      out = store(out, block.reb_home(index));
+      break;
+    case Column::PtsHome:
+      out = store(out, block.pts_home(index));
+      break;
+    case Column::HomeTeamWins:
+      out = store(out, (uint8_t)block.home_team_wins(index));
+      break;
+    }
+  }
+}
+
+Column parse_column(const std::string &name) {
+  if (name == "game_date_est")
+    return Column::GameDateEst;
+  if (name == "team_id_home")
+    return Column::TeamIdHome;
+  if (name == "fg_pct_home")
+    return Column::FgPctHome;
+  if (name == "ft_pct_home")
+    return Column::FtPctHome;
+  if (name == "fg3_pct_home")
+    return Column::Fg3PctHome;
+  if (name == "ast_home")
+    return Column::AstHome;
+  if (name == "reb_home")
+    return Column::RebHome;
+  if (name == "pts_home")
+    return Column::PtsHome;
+  if (name == "home_team_wins")
+    return Column::HomeTeamWins;
+  throw std::invalid_argument("Unknown column '" + name + "'.");
+}
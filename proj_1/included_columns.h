@@ -0,0 +1,53 @@
+#ifndef INCLUDED_COLUMNS_H
+#define INCLUDED_COLUMNS_H
+
+#include "storage/data_block.h"
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Columns a covering index stores in its leaves along with each record, so
+// that queries reading only the key and these columns never access the data
+// blocks. The values of a record are packed native-endian, in column order,
+// into size() bytes carried in its posting list.
+class IncludedColumns {
+public:
+  IncludedColumns() {};
+  // Throws if a column is repeated or the values take too many bytes.
+  explicit IncludedColumns(std::vector<Column> columns);
+
+  const std::vector<Column> &columns() const { return this->m_columns; };
+  bool empty() const { return this->m_columns.empty(); };
+  bool contains(Column column) const;
+  // Bytes taken by the values of a record.
+  size_t size() const { return this->m_size; };
+
+  // Writes the values of the record at index in block into out.
+  void encode(const DataBlockView &block, size_t index, uint8_t *out) const;
+  // Reads the value of column from the values of a record. T must be the
+  // type of the column.
+  template <typename T> T value(const uint8_t *values, Column column) const;
+
+private:
+  size_t offset_of(Column column) const;
+
+  std::vector<Column> m_columns;
+  std::vector<size_t> m_offsets;
+  size_t m_size = 0;
+};
+
+template <typename T>
+T IncludedColumns::value(const uint8_t *values, Column column) const {
+  if (!column_holds<T>(column))
+    throw std::invalid_argument("Column does not hold values of this type.");
+  T value;
+  std::memcpy(&value, values + this->offset_of(column), sizeof(T));
+  return value;
+}
+
+// Parses a column by its field name, such as "pts_home".
+Column parse_column(const std::string &name);
+
+#endif // INCLUDED_COLUMNS_H
@@ -0,0 +1,117 @@
+#ifndef KEY_CODEC_H
+#define KEY_CODEC_H
+
+#include "key_search.h"
+#include "storage/serialize.h"
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <type_traits>
+
+// Key made of two columns, ordered by the first and then the second, such as
+// (team_id_home, game_date_est).
+template <typename First, typename Second> struct CompositeKey {
+  First first;
+  Second second;
+
+  bool operator<(const CompositeKey &other) const {
+    return first < other.first ||
+           (first == other.first && second < other.second);
+  };
+  bool operator==(const CompositeKey &other) const {
+    return first == other.first && second == other.second;
+  };
+  bool operator!=(const CompositeKey &other) const {
+    return !(*this == other);
+  };
+  bool operator>(const CompositeKey &other) const { return other < *this; };
+  bool operator<=(const CompositeKey &other) const {
+    return !(other < *this);
+  };
+  bool operator>=(const CompositeKey &other) const {
+    return !(*this < other);
+  };
+};
+
+template <typename First, typename Second>
+std::ostream &operator<<(std::ostream &stream,
+                         const CompositeKey<First, Second> &key) {
+  return stream << "(" << key.first << ", " << key.second << ")";
+}
+
+// Compile-time description of an index key type: its size, order, search and
+// serialization. Index pages hold an array of keys used in memory as-is, so
+// every node function is compiled for the key type with no runtime dispatch.
+// Only the key types specialized below can be used.
+template <typename Key> struct KeyCodec;
+
+// Binary search, for keys without a specialized search.
+template <typename Key> struct BinarySearchKeyCodec {
+  static_assert(std::is_trivially_copyable_v<Key>,
+                "Keys are stored in pages as-is.");
+  static_assert(sizeof(Key) % 4 == 0,
+                "Keys must keep the values after them aligned.");
+  static constexpr size_t SIZE = sizeof(Key);
+
+  // Index of the first key >= key, like std::lower_bound.
+  static size_t count_less(const Key *keys, size_t count, const Key &key) {
+    return std::lower_bound(keys, keys + count, key) - keys;
+  };
+  // Index of the first key > key, like std::upper_bound.
+  static size_t count_less_equal(const Key *keys, size_t count,
+                                 const Key &key) {
+    return std::upper_bound(keys, keys + count, key) - keys;
+  };
+};
+
+template <> struct KeyCodec<float> {
+  static constexpr size_t SIZE = sizeof(float);
+
+  static float lowest() { return -std::numeric_limits<float>::infinity(); };
+  static size_t count_less(const float *keys, size_t count, float key) {
+    return count_keys_less(keys, count, key);
+  };
+  static size_t count_less_equal(const float *keys, size_t count, float key) {
+    return count_keys_less_equal(keys, count, key);
+  };
+  static size_t write(std::ostream &stream, float key) {
+    return Serializer::write_float(stream, key);
+  };
+  static float read(std::istream &stream) {
+    return Serializer::read_float(stream);
+  };
+};
+
+template <> struct KeyCodec<uint32_t> : BinarySearchKeyCodec<uint32_t> {
+  static uint32_t lowest() { return 0; };
+  static size_t write(std::ostream &stream, uint32_t key) {
+    return Serializer::write_uint32(stream, key);
+  };
+  static uint32_t read(std::istream &stream) {
+    return Serializer::read_uint32(stream);
+  };
+};
+
+template <typename First, typename Second>
+struct KeyCodec<CompositeKey<First, Second>>
+    : BinarySearchKeyCodec<CompositeKey<First, Second>> {
+  using Key = CompositeKey<First, Second>;
+
+  static Key lowest() {
+    return {KeyCodec<First>::lowest(), KeyCodec<Second>::lowest()};
+  };
+  static size_t write(std::ostream &stream, const Key &key) {
+    return KeyCodec<First>::write(stream, key.first) +
+           KeyCodec<Second>::write(stream, key.second);
+  };
+  static Key read(std::istream &stream) {
+    auto first = KeyCodec<First>::read(stream);
+    return {first, KeyCodec<Second>::read(stream)};
+  };
+};
+
+// Index on (team_id_home, game_date_est).
+using TeamDateKey = CompositeKey<uint32_t, uint32_t>;
+
+#endif // KEY_CODEC_H
@@ -0,0 +1,53 @@
+#include "key_search.h"
+#include "simd.h"
+
+// Nodes with more keys than this are first narrowed down by binary search, as
+// scanning them would cost more than the branch misses saved.
+constexpr size_t LINEAR_SEARCH_KEYS = 128;
+
+// Counts the keys below key, or at most key if inclusive. As the keys are
+// sorted, scanning stops at the first chunk that is not entirely below.
+template <bool inclusive>
+static size_t count_keys_below(const float *keys, size_t count, float key) {
+  size_t i = 0;
+  while (count - i > LINEAR_SEARCH_KEYS) {
+    auto middle = i + (count - i) / 2;
+    if (inclusive ? keys[middle] <= key : keys[middle] < key)
+      i = middle + 1;
+    else
+      count = middle;
+  }
+#ifdef __AVX2__
+  auto needle8 = _mm256_set1_ps(key);
+  for (; i + 8 <= count; i += 8) {
+    auto chunk = _mm256_loadu_ps(keys + i);
+    auto mask = _mm256_movemask_ps(
+        inclusive ? _mm256_cmp_ps(chunk, needle8, _CMP_LE_OQ)
+                  : _mm256_cmp_ps(chunk, needle8, _CMP_LT_OQ));
+    if (mask != 0xFF)
+      return i + popcount(mask);
+  }
+#endif
+#ifdef SIMD_SSE2
+  auto needle4 = _mm_set1_ps(key);
+  for (; i + 4 <= count; i += 4) {
+    auto chunk = _mm_loadu_ps(keys + i);
+    auto mask = _mm_movemask_ps(inclusive ? _mm_cmple_ps(chunk, needle4)
+                                          : _mm_cmplt_ps(chunk, needle4));
+    if (mask != 0xF)
+      return i + popcount(mask);
+  }
+#endif
+  size_t result = i;
+  for (; i < count; ++i)
+    result += inclusive ? keys[i] <= key : keys[i] < key;
+  return result;
+}
+
+size_t count_keys_less(const float *keys, size_t count, float key) {
+  return count_keys_below<false>(keys, count, key);
+}
+
+size_t count_keys_less_equal(const float *keys, size_t count, float key) {
+  return count_keys_below<true>(keys, count, key);
+}
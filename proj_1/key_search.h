@@ -0,0 +1,16 @@
+#ifndef KEY_SEARCH_H
+#define KEY_SEARCH_H
+
+#include <cstddef>
+
+// Searches over the sorted key array of a node. Rather than binary searching,
+// the keys are compared against the search key in SIMD registers and the
+// matches are counted, which is branch-free apart from the early exit once a
+// chunk holds a larger key. See simd.h for the instruction sets used.
+
+// Index of the first key >= key, like std::lower_bound.
+size_t count_keys_less(const float *keys, size_t count, float key);
+// Index of the first key > key, like std::upper_bound.
+size_t count_keys_less_equal(const float *keys, size_t count, float key);
+
+#endif // KEY_SEARCH_H
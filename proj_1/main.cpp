@@ -1,69 +1,215 @@
+#include "benchmark.h"
 #include "bp_tree.h"
+#include "hash_index.h"
+#include "included_columns.h"
+#include "parallel.h"
 #include "storage/data_block.h"
 #include "storage/storage.h"
 #include "task.h"
 #include <assert.h>
+#include <chrono>
+#include <memory>
+#include <sstream>
+
+// Where the database is written, and the names of its indexes in the
+// superblock, by which a later run reopens them.
+const std::string STORAGE_LOCATION = "data/block_";
+const std::string TREE_NAME = "fg_pct_home";
+const std::string TEAM_INDEX_NAME = "team_id_home";
+const std::string DATE_INDEX_NAME = "game_date_est";
+
+// Reads the index key of every record, with each thread reading its own range
+// of data blocks.
+std::vector<BulkLoadEntry<float>>
+extract_entries(Storage *storage, int block_count, int thread_count) {
+  std::vector<std::vector<BulkLoadEntry<float>>> parts(thread_count);
+  parallel_for(thread_count, [&](int t) {
+    auto first = (long long)block_count * t / thread_count;
+    auto last = (long long)block_count * (t + 1) / thread_count;
+    for (auto i = first; i < last; ++i) {
+      auto b = storage->get_data_block_view(i);
+      for (size_t j = 0; j < b.size(); ++j) {
+        RecordPointer recordPointer = {.block_id = b.id(), .offset = (int)j};
+        parts[t].push_back({.key = b.fg_pct_home(j), .record = recordPointer});
+      }
+    }
+  });
+  // Concatenate in block order so that equal keys keep their record order.
+  std::vector<BulkLoadEntry<float>> entries;
+  for (auto &part : parts)
+    entries.insert(entries.end(), part.begin(), part.end());
+  return entries;
+}
 
 int main(int argc, char *argv[]) {
-  if (argc < 3) {
-    std::cerr << "Usage: " << argv[0] << " <BPlusTree degree> <input file>"
+  bool run_benchmarks = false, reopen = false, valid_options = true;
+  // Whether options only used to build the database were given.
+  bool build_options = false;
+  auto layout = DataLayout::Row;
+  auto read_ahead = DEFAULT_READ_AHEAD_BLOCKS;
+  IncludedColumns included;
+  for (int i = 3; i < argc; ++i) {
+    std::string option = argv[i];
+    if (option == "--bench")
+      run_benchmarks = true;
+    else if (option == "--columnar") {
+      layout = DataLayout::Columnar;
+      build_options = true;
+    } else if (option == "--reopen")
+      reopen = true;
+    else if (option == "--read-ahead" && i + 1 < argc)
+      read_ahead = std::atoi(argv[++i]);
+    else if (option == "--include" && i + 1 < argc) {
+      // Comma separated columns the index covers, such as "pts_home,ast_home".
+      std::stringstream names(argv[++i]);
+      std::vector<Column> columns;
+      std::string name;
+      try {
+        while (std::getline(names, name, ','))
+          columns.push_back(parse_column(name));
+        included = IncludedColumns(columns);
+        build_options = true;
+      } catch (const std::invalid_argument &error) {
+        std::cerr << error.what() << std::endl;
+        valid_options = false;
+      }
+    } else
+      valid_options = false;
+  }
+  if (argc < 3 || !valid_options || read_ahead < 0) {
+    std::cerr << "Usage: " << argv[0]
+              << " <BPlusTree degree> <input file> [--bench] [--columnar]"
+                 " [--read-ahead <blocks>] [--include <column,...>]"
+                 " [--reopen]"
               << std::endl;
     return 1;
   }
 
-  auto storage = Storage("data/block_", 0, 0, 0);
-  auto optimal_degree = Node::max_record_count(storage.block_size);
-  int degree = std::stoi(argv[1]);
-  if (degree <= 1) {
-    std::cerr << "Invalid BPlusTree degree. Defaulting to optimal value of "
-              << optimal_degree << "." << std::endl;
-    degree = optimal_degree;
-  } else if (degree != optimal_degree) {
-    std::cerr << "Using degree " << degree
-              << " as requested instead of optimal value of " << optimal_degree
-              << "." << std::endl;
-  } else {
-    std::cerr << "Using degree " << degree << " as requested (optimal)."
+  // Reopening uses the layout, degree and included columns the database was
+  // built with, and skips the input file.
+  if (reopen && build_options) {
+    std::cerr << "--columnar and --include cannot be used with --reopen."
               << std::endl;
+    return 1;
   }
-
-  std::string inputFile = argv[2];
-  if (inputFile != "games.txt" && inputFile != "games_sorted.txt") {
-    std::cerr << "Invalid input file. It must be either 'games.txt' or "
-                 "'games_sorted.txt'."
+  if (reopen && !Storage::exists(STORAGE_LOCATION)) {
+    std::cerr << "No database to reopen. Run without --reopen first."
               << std::endl;
     return 1;
   }
 
-  std::vector<Record> records = read_records_from_file(inputFile);
+  // Read before creating the storage, which empties the files of the last
+  // one, so that a bad input file leaves them to be reopened.
+  std::vector<Record> records;
+  if (!reopen) {
+    std::string inputFile = argv[2];
+    if (inputFile != "games.txt" && inputFile != "games_sorted.txt") {
+      std::cerr << "Invalid input file. It must be either 'games.txt' or "
+                   "'games_sorted.txt'."
+                << std::endl;
+      return 1;
+    }
+    records = read_records_from_file(inputFile);
+    if (records.empty()) {
+      std::cerr << "No records found in the file.\n";
+      return 1;
+    }
+  }
 
-  if (records.empty()) {
-    std::cerr << "No records found in the file.\n";
-    return 1;
+  auto storage = reopen ? Storage::open(STORAGE_LOCATION)
+                        : Storage(STORAGE_LOCATION, 0, 0, 0,
+                                  DEFAULT_BUFFER_POOL_BYTES,
+                                  StorageMode::ReadWrite, layout);
+  std::cout << "System block size: " << storage.block_size << " byte"
+            << std::endl;
+  storage.set_read_ahead(read_ahead);
+  // A reopened tree keeps the degree it was built with.
+  int degree = 0;
+  if (!reopen) {
+    int optimal_degree = (int)Node::max_record_count<float>(storage.block_size);
+    // Anything but a number falls back to the optimal degree.
+    degree = std::atoi(argv[1]);
+    if (degree <= 1) {
+      std::cerr << "Invalid BPlusTree degree. Defaulting to optimal value of "
+                << optimal_degree << "." << std::endl;
+      degree = optimal_degree;
+    } else if (degree > optimal_degree) {
+      std::cerr << "Degree " << degree << " does not fit in a block. Using "
+                << "optimal value of " << optimal_degree << " instead."
+                << std::endl;
+      degree = optimal_degree;
+    } else if (degree != optimal_degree) {
+      std::cerr << "Using degree " << degree
+                << " as requested instead of optimal value of "
+                << optimal_degree << "." << std::endl;
+    } else {
+      std::cerr << "Using degree " << degree << " as requested (optimal)."
+                << std::endl;
+    }
   }
 
-  std::cout << std::endl;
-  std::cout << "Step 0: Construct Database and Tree" << std::endl;
-  auto block_count = storage.write_data_blocks(records);
-
-  BPlusTree tree = BPlusTree(&storage, degree);
-  for (int i = 0; i < block_count; i++) {
-    DataBlock b = *storage.get_data_block(i);
-    int record_offset = 0;
-    for (Record &record : b.records) {
-      RecordPointer recordPointer = {.block_id = b.id, .offset = record_offset};
-      tree.insert(record.fg_pct_home, recordPointer);
-      ++record_offset;
-    };
+  std::unique_ptr<BPlusTree<float>> tree;
+  int block_count;
+  if (reopen) {
+    std::cout << std::endl;
+    std::cout << "Step 0: Reopen Database and Tree" << std::endl;
+    auto start = std::chrono::high_resolution_clock::now();
+    try {
+      tree = BPlusTree<float>::open(&storage, TREE_NAME);
+    } catch (const std::runtime_error &error) {
+      // Such as after a build that never finished.
+      std::cerr << error.what() << std::endl;
+      return 1;
+    }
+    block_count = storage.data_block_count();
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "Database reopened in "
+              << std::chrono::duration<double>(end - start).count() << "s ("
+              << storage.number_of_records << " records in " << block_count
+              << " blocks, tree of degree " << tree->get_degree() << ")."
+              << std::endl;
+  } else {
+    std::cout << std::endl;
+    std::cout << "Step 0: Construct Database and Tree" << std::endl;
+    block_count = storage.write_data_blocks(records);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    auto thread_count = default_thread_count();
+    auto entries = extract_entries(&storage, block_count, thread_count);
+    // Aggregated, so that task 3 can also be answered from the internal
+    // nodes.
+    tree = std::make_unique<BPlusTree<float>>(&storage, degree, included,
+                                              true);
+    tree->record_in_superblock(TREE_NAME);
+    tree->bulk_load(std::move(entries), DEFAULT_FILL_FACTOR, thread_count);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "Index built in "
+              << std::chrono::duration<double>(end - start).count()
+              << "s using " << thread_count << " thread(s)." << std::endl;
+
+    // Exact-match indexes for point lookups by team and by date.
+    start = std::chrono::high_resolution_clock::now();
+    HashIndex team_index(&storage, Column::TeamIdHome);
+    team_index.insert_data_blocks();
+    team_index.record_in_superblock(TEAM_INDEX_NAME);
+    HashIndex date_index(&storage, Column::GameDateEst);
+    date_index.insert_data_blocks();
+    date_index.record_in_superblock(DATE_INDEX_NAME);
+    end = std::chrono::high_resolution_clock::now();
+    std::cout << "Hash indexes built in "
+              << std::chrono::duration<double>(end - start).count() << "s ("
+              << team_index.bucket_count() << " and "
+              << date_index.bucket_count() << " buckets)." << std::endl;
   }
   std::cout << std::endl;
+  // Also writes the superblock, from which later runs reopen the database.
   storage.flush_blocks();
 
   // Sanity check that the tree is sorted.
   float prev_key = -10000;
-  for (auto it = tree.begin(); it != tree.end(); ++it) {
-    assert(prev_key <= it->fg_pct_home);
-    prev_key = it->fg_pct_home;
+  for (auto it = tree->begin(); it != tree->end(); ++it) {
+    assert(prev_key <= it->fg_pct_home());
+    prev_key = it->fg_pct_home();
   }
 
   std::cout << "Task 1: Storage" << std::endl;
@@ -71,10 +217,40 @@ int main(int argc, char *argv[]) {
   std::cout << std::endl;
 
   std::cout << "Task 2: B-Tree Statistics" << std::endl;
-  task_2(&tree);
+  task_2(tree.get());
   std::cout << std::endl;
 
-  task_3(&tree, &storage, block_count);
+  // Queries only read, so run them against a read-only copy of the storage
+  // with the data blocks memory mapped.
+  auto mapped_storage = Storage::open(
+      STORAGE_LOCATION, DEFAULT_BUFFER_POOL_BYTES, StorageMode::ReadOnlyMapped);
+  mapped_storage.set_read_ahead(read_ahead);
+  auto mapped_tree = BPlusTree<float>::open(&mapped_storage, TREE_NAME);
+  task_3(mapped_tree.get(), &mapped_storage, block_count);
+
+  auto mapped_team_index = HashIndex::open(&mapped_storage, TEAM_INDEX_NAME);
+  auto mapped_date_index = HashIndex::open(&mapped_storage, DATE_INDEX_NAME);
+  auto first_record = mapped_storage.get_data_block_view(0).record(0);
+  point_lookups(mapped_team_index.get(), &mapped_storage, block_count,
+                first_record.team_id_home);
+  point_lookups(mapped_date_index.get(), &mapped_storage, block_count,
+                first_record.game_date_est);
+
+  if (run_benchmarks) {
+    std::cout << "Benchmarks" << std::endl;
+    benchmark_key_search();
+    std::cout << std::endl;
+    benchmark_scan_kernel();
+    std::cout << std::endl;
+    benchmark_concurrent_lookups();
+    std::cout << std::endl;
+    benchmark_mixed_workload();
+    std::cout << std::endl;
+    benchmark_group_commit();
+    std::cout << std::endl;
+    benchmark_background_writer();
+    std::cout << std::endl;
+  }
 
   return 0;
 }
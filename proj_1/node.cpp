@@ -3,6 +3,8 @@
 #include "storage/storage.h"
 #include <algorithm>
 #include <assert.h>
+#include <stdexcept>
+#include <string>
 
 int ceil_div(int a, int b) { return (a + b - 1) / b; };
 
@@ -10,450 +12,421 @@ int floor_div(int a, int b) { return a / b; };
 
 OverflowBlock::OverflowBlock(int block_id, std::istream &stream)
     : id(block_id) {
-  auto size = Serializer::read_uint32(stream);
-  this->records.reserve(size);
-  for (auto i = 0; i < size; ++i) {
-    auto block_id = Serializer::read_uint32(stream);
-    auto offset = Serializer::read_uint16(stream);
-    this->records.push_back({.block_id = (int)block_id, .offset = offset});
-  }
+  auto count = Serializer::read_uint32(stream);
+  auto payload_size = Serializer::read_uint8(stream);
+  auto size = Serializer::read_uint16(stream);
+  if (payload_size > MAX_PAYLOAD_SIZE)
+    throw std::runtime_error("Corrupted overflow page " +
+                             std::to_string(block_id) + ".");
+  std::vector<uint8_t> encoded(size);
+  stream.read(reinterpret_cast<char *>(encoded.data()), size);
+  this->records = PostingRun(encoded.data(), size, count, payload_size);
   auto has_next = Serializer::read_bool(stream);
   if (has_next) {
     auto block_id = Serializer::read_uint32(stream);
     this->next = {{.block_id = (int)block_id}};
   }
+  auto has_skip = Serializer::read_bool(stream);
+  if (has_skip) {
+    auto block_id = Serializer::read_uint32(stream);
+    auto first_block_id = Serializer::read_uint32(stream);
+    auto first_offset = Serializer::read_uint32(stream);
+    this->skip = {{.block_id = (int)block_id,
+                   .first = {.block_id = (int)first_block_id,
+                             .offset = (int)first_offset}}};
+  }
   assert(!stream.fail());
   assert(stream_just_ended(stream));
 }
 
 int OverflowBlock::serialize(std::ostream &stream) const {
   auto size = 0;
-  assert(this->records.size() < 0xFFFFFFFF);
-  size += Serializer::write_uint32(stream, this->records.size());
-  for (const RecordPointer &record : this->records) {
-    assert(record.block_id < 0xFFFFFFFF);
-    assert(record.offset < 0xFFFF);
-    size += Serializer::write_uint32(stream, record.block_id);
-    size += Serializer::write_uint16(stream, record.offset);
-  }
+  const auto &encoded = this->records.bytes;
+  assert(encoded.size() < 0xFFFF);
+  size += Serializer::write_uint32(stream, this->records.count);
+  size += Serializer::write_uint8(stream, this->records.payload_size);
+  size += Serializer::write_uint16(stream, encoded.size());
+  stream.write(reinterpret_cast<const char *>(encoded.data()), encoded.size());
+  size += encoded.size();
   size += Serializer::write_bool(stream, this->next.has_value());
   if (this->next.has_value()) {
     assert(this->next.value().block_id < 0xFFFFFFFF);
     size += Serializer::write_uint32(stream, this->next.value().block_id);
   }
+  size += Serializer::write_bool(stream, this->skip.has_value());
+  if (this->skip.has_value()) {
+    const auto &skip = this->skip.value();
+    size += Serializer::write_uint32(stream, skip.block_id);
+    size += Serializer::write_uint32(stream, skip.first.block_id);
+    size += Serializer::write_uint32(stream, skip.first.offset);
+  }
   return size;
 }
 
-size_t OverflowBlock::max_record_count(size_t block_size) {
-  auto record_size = 4 + 2;
+size_t OverflowBlock::max_encoded_size(size_t block_size) {
+  auto header_size = 4 + 1 + 2;
   auto next_block_size = 1 + 4;
-  return (block_size - 4 - next_block_size) / record_size;
+  auto skip_size = 1 + 4 + 4 + 4;
+  return block_size - header_size - next_block_size - skip_size;
 }
 
-NodeRecords::NodeRecords(std::istream &stream) {
-  this->record_count = Serializer::read_uint8(stream);
-  assert(this->record_count <= IN_BLOCK_RECORDS);
-  for (auto i = 0; i < this->record_count; ++i) {
-    auto block_id = Serializer::read_uint32(stream);
-    auto offset = Serializer::read_uint16(stream);
-    this->records[i] = {.block_id = (int)block_id, .offset = offset};
-  }
-  auto has_next = Serializer::read_bool(stream);
-  if (has_next) {
-    auto block_id = Serializer::read_uint32(stream);
-    this->more_records = {{.block_id = (int)block_id}};
-  } else {
-    this->more_records = {};
-  }
+void NodeRecords::clear(size_t payload_size) {
+  this->more_records = -1;
+  this->last_block = -1;
+  this->skip_from = -1;
+  this->pages_since_skip = 0;
+  this->encoded_size = 0;
+  this->record_count = 0;
+  this->count = 0;
+  this->payload_size = payload_size;
+  std::fill(this->encoded, this->encoded + INLINE_POSTING_BYTES, 0);
 }
 
-int NodeRecords::serialize(std::ostream &stream) const {
-  auto size = 0;
-  static_assert(IN_BLOCK_RECORDS < 0xFF, "Record count must fit in uint8");
-  size += Serializer::write_uint8(stream, this->record_count);
-  for (auto i = 0; i < record_count; ++i) {
-    size += Serializer::write_uint32(stream, this->records[i].block_id);
-    size += Serializer::write_uint16(stream, this->records[i].offset);
-  }
-  size += Serializer::write_bool(stream, this->more_records.has_value());
-  if (this->more_records.has_value()) {
-    auto block_id = this->more_records.value().block_id;
-    assert(block_id < 0xFFFFFFFF);
-    size += Serializer::write_uint32(stream, block_id);
-  }
-  return size;
+PostingRun NodeRecords::inline_run() const {
+  return PostingRun(this->encoded, this->encoded_size, this->record_count,
+                    this->payload_size);
 }
 
-void NodeRecords::clear() {
-  this->record_count = 0;
-  for (auto i = 0; i < IN_BLOCK_RECORDS; ++i)
-    this->records[i] = {};
-  this->more_records = {};
+void NodeRecords::set_inline_run(const PostingRun &run) {
+  assert(run.bytes.size() <= INLINE_POSTING_BYTES);
+  assert(run.payload_size == this->payload_size);
+  this->record_count = run.count;
+  this->encoded_size = run.bytes.size();
+  std::copy(run.bytes.begin(), run.bytes.end(), this->encoded);
 }
 
-void NodeRecords::push_back(Storage *storage, RecordPointer ptr) {
-  if (this->record_count < IN_BLOCK_RECORDS) {
-    // Store it in the block.
-    this->records[this->record_count] = ptr;
-    ++this->record_count;
-    return;
+// Inserts record into run, which has no room for it, by moving the upper half
+// of run to the front of the page after it if that has room, or else to a new
+// page which is returned for the caller to link in after run. Appending past
+// the end of the list only starts a new page, so pages filled in order stay
+// full.
+static OverflowBlock *spill(PostingRun &run, size_t capacity,
+                            BlockRef<OverflowBlock> &next, size_t page_capacity,
+                            RecordPointer record, const uint8_t *payload) {
+  auto block = new OverflowBlock();
+  block->records = PostingRun(run.payload_size);
+  if (!next && !location_less(record, run.last)) {
+    block->records.insert(record, payload, page_capacity);
+    return block;
   }
-  // Follow overflow block towards the end.
-  auto max_records_per_overflow_block =
-      OverflowBlock::max_record_count(storage->block_size);
-
-  auto new_overflow_location = &this->more_records;
-  OverflowBlock *current = nullptr;
-  while (new_overflow_location->has_value()) {
-    auto overflow_block_id = new_overflow_location->value().block_id;
-    current = storage->get_overflow_block(overflow_block_id);
-    new_overflow_location = &current->next;
-    if (current->records.size() != max_records_per_overflow_block) {
-      assert(!current->next.has_value());
-      break;
+  auto upper = run.split();
+  auto inserted = location_less(record, upper.first())
+                      ? run.insert(record, payload, capacity)
+                      : upper.insert(record, payload, page_capacity);
+  assert(inserted);
+  block->records = std::move(upper);
+  if (next) {
+    // Every record in the next page is larger, so they are appended.
+    auto merged = block->records;
+    auto decoder = next->records.decoder();
+    RecordPointer moved;
+    auto fits = true;
+    while (fits && decoder.next(moved))
+      fits = merged.insert(moved, decoder.payload(), page_capacity);
+    if (fits) {
+      next->records = std::move(merged);
+      next.mark_dirty();
+      delete block;
+      return nullptr;
     }
   }
-  // If we have space, just write to the overflow block.
-  if (current && current->records.size() <
-                     current->max_record_count(storage->block_size)) {
-    current->records.push_back(ptr);
+  return block;
+}
+
+void NodeRecords::find_run(Storage *storage, RecordPointer record,
+                           BlockRef<OverflowBlock> &target,
+                           BlockRef<OverflowBlock> &next) const {
+  if (this->more_records < 0)
+    return;
+  auto last = storage->get_overflow_block(this->last_block);
+  if (!location_less(record, last->records.first())) {
+    target = last;
     return;
   }
-  // Otherwise, create a new overflow block.
-  auto new_block = new OverflowBlock();
-  new_block->records.push_back(ptr);
-  *new_overflow_location = {.block_id =
-                                storage->track_new_overflow_block(new_block)};
-};
-
-// Empty node creation.
-Node::Node(int degree, bool is_leaf) : m_is_leaf(is_leaf), m_degree(degree) {
-  assert(degree > 2);
-  this->m_keys = new float[degree];
-  if (is_leaf) {
-    this->m_record_values = new NodeRecords[degree];
-    this->m_next = {};
+  auto block = storage->get_overflow_block(this->more_records);
+  if (location_less(record, block->records.first())) {
+    next = block;
     return;
   }
-  auto child_node_count = degree + 1;
-  this->m_node_values = new NodePointer[child_node_count];
-};
-
-// Internal node creation.
-Node::Node(int degree, NodePointer a, float key, NodePointer b)
-    : Node(degree, false) {
-  assert(degree > 2);
-  this->m_keys[0] = key;
-  this->m_node_values[0] = a;
-  this->m_node_values[1] = b;
-  m_size = 2;
-};
+  // The record goes before the last page, so every page on the way has a
+  // next one.
+  while (true) {
+    if (block->skip.has_value() &&
+        !location_less(record, block->skip.value().first)) {
+      block = storage->get_overflow_block(block->skip.value().block_id);
+      continue;
+    }
+    assert(block->next.has_value());
+    auto following = storage->get_overflow_block(block->next.value().block_id);
+    if (location_less(record, following->records.first())) {
+      target = block;
+      next = following;
+      return;
+    }
+    block = following;
+  }
+}
 
-Node::~Node() {
-  delete[] m_keys;
-  if (m_is_leaf) {
-    delete[] m_record_values;
+void NodeRecords::append_block(Storage *storage,
+                               const BlockRef<OverflowBlock> &block) {
+  assert(!block->next.has_value());
+  this->last_block = block->id;
+  if (this->skip_from >= 0 &&
+      ++this->pages_since_skip < OVERFLOW_SKIP_STRIDE)
     return;
+  if (this->skip_from >= 0) {
+    auto from = storage->get_overflow_block(this->skip_from);
+    from->skip = {{.block_id = block->id, .first = block->records.first()}};
+    from.mark_dirty();
   }
-  delete[] m_node_values;
-};
+  this->skip_from = block->id;
+  this->pages_since_skip = 0;
+}
 
-NodePointer::NodePointer(std::istream &stream) {
-  auto block_id = Serializer::read_uint32(stream);
-  this->block_id = (int)block_id;
+void NodeRecords::insert(Storage *storage, RecordPointer record,
+                         const uint8_t *payload) {
+  auto page_capacity =
+      OverflowBlock::max_encoded_size(storage->usable_block_size());
+  ++this->count;
+  BlockRef<OverflowBlock> target, next;
+  this->find_run(storage, record, target, next);
+
+  if (!target) {
+    auto run = this->inline_run();
+    if (!run.insert(record, payload, INLINE_POSTING_BYTES)) {
+      auto block = spill(run, INLINE_POSTING_BYTES, next, page_capacity,
+                         record, payload);
+      if (block) {
+        if (next)
+          block->next = {{.block_id = next->id}};
+        auto block_ref = storage->track_new_overflow_block(block);
+        this->more_records = block_ref->id;
+        if (!next)
+          this->append_block(storage, block_ref);
+      }
+    }
+    this->set_inline_run(run);
+    return;
+  }
+  if (!target->records.insert(record, payload, page_capacity)) {
+    auto block = spill(target->records, page_capacity, next, page_capacity,
+                       record, payload);
+    if (block) {
+      block->next = target->next;
+      auto block_ref = storage->track_new_overflow_block(block);
+      target->next = {{.block_id = block_ref->id}};
+      if (!block->next.has_value())
+        this->append_block(storage, block_ref);
+    }
+  }
+  target.mark_dirty();
 }
 
-int NodePointer::serialize(std::ostream &stream) const {
-  return Serializer::write_uint32(stream, this->block_id);
+PostingCursor::PostingCursor(Storage *storage, const NodeRecords &records)
+    : m_storage(storage), m_decoder(records.decoder()),
+      m_next_block(records.more_records) {}
+
+void PostingCursor::enter_block(int id) {
+  this->m_block = this->m_storage->get_overflow_block(id);
+  this->m_decoder = this->m_block->records.decoder();
+  const auto &next = this->m_block->next;
+  this->m_next_block = next.has_value() ? next.value().block_id : -1;
 }
 
-Node::Node(int block_id, std::istream &stream) : id(block_id) {
-  this->m_is_leaf = Serializer::read_bool(stream);
-  this->m_degree = Serializer::read_uint16(stream);
-  this->m_size = Serializer::read_uint16(stream);
-  assert(this->m_size <= this->m_degree + 1);
-  this->m_keys = new float[this->key_count()];
-  for (auto i = 0; i < this->key_count(); ++i) {
-    this->m_keys[i] = Serializer::read_float(stream);
+bool PostingCursor::next(RecordPointer &record) {
+  while (!this->m_decoder.next(record)) {
+    if (this->m_next_block < 0)
+      return false;
+    this->enter_block(this->m_next_block);
   }
-  if (this->m_is_leaf) {
-    this->m_record_values = new NodeRecords[this->m_size];
-    for (auto i = 0; i < this->m_size; ++i)
-      this->m_record_values[i] = NodeRecords(stream);
-    auto has_next = Serializer::read_bool(stream);
-    if (has_next) {
-      this->m_next = {{NodePointer(stream)}};
-    } else {
-      this->m_next = {};
+  return true;
+}
+
+bool PostingCursor::seek(RecordPointer target, RecordPointer &record) {
+  while (true) {
+    // Pages that end before the target are not decoded at all.
+    if (!this->m_block ||
+        !location_less(this->m_block->records.last, target)) {
+      while (this->m_decoder.next(record))
+        if (!location_less(record, target))
+          return true;
     }
-  } else {
-    this->m_node_values = new NodePointer[this->m_size];
-    for (auto i = 0; i < this->m_size; ++i)
-      this->m_node_values[i] = NodePointer(stream);
+    auto skip = this->m_block ? this->m_block->skip : std::nullopt;
+    if (skip.has_value() && !location_less(target, skip.value().first))
+      this->enter_block(skip.value().block_id);
+    else if (this->m_next_block >= 0)
+      this->enter_block(this->m_next_block);
+    else
+      return false;
   }
-  assert(!stream.fail());
-  assert(stream_just_ended(stream));
 }
 
-int Node::serialize(std::ostream &stream) const {
-  auto size = 0;
-  size += Serializer::write_bool(stream, this->m_is_leaf);
-  assert(this->m_degree < 0xFFFF);
-  assert(this->m_size < 0xFFFF);
-  size += Serializer::write_uint16(stream, this->m_degree);
-  size += Serializer::write_uint16(stream, this->m_size);
-  for (auto i = 0; i < this->key_count(); ++i)
-    Serializer::write_float(stream, this->m_keys[i]);
-  if (this->m_is_leaf) {
-    for (auto i = 0; i < this->m_size; ++i)
-      size += this->m_record_values[i].serialize(stream);
-    size += Serializer::write_bool(stream, this->m_next.has_value());
-    if (this->m_next.has_value())
-      size += this->m_next.value().serialize(stream);
-  } else {
-    for (auto i = 0; i < this->m_size; ++i)
-      size += this->m_node_values[i].serialize(stream);
+// Empty node creation.
+Node::Node(int degree, size_t key_size, size_t payload_size, size_t page_size,
+           bool is_leaf, bool has_aggregates)
+    : m_page(new char[page_size]{}), m_page_size(page_size) {
+  assert(degree > 2);
+  assert(key_size > 0 && key_size <= UINT8_MAX);
+  assert(key_size % alignof(NodeRecords) == 0);
+  assert(payload_size <= MAX_PAYLOAD_SIZE);
+  this->m_header = reinterpret_cast<NodeHeader *>(this->m_page);
+  this->m_header->is_leaf = is_leaf;
+  this->m_header->key_size = key_size;
+  this->m_header->payload_size = payload_size;
+  this->m_header->has_aggregates = has_aggregates;
+  this->m_header->degree = degree;
+  this->m_header->size = 0;
+  this->m_header->next = -1;
+  auto layout_size = this->bind_page();
+  assert(layout_size <= page_size);
+  if (is_leaf) {
+    for (auto i = 0; i < degree; ++i)
+      this->m_record_values[i].clear(payload_size);
+    return;
   }
-  return size;
+  auto child_node_count = degree + 1;
+  std::fill(this->m_node_values, this->m_node_values + child_node_count,
+            NodePointer(-1));
+  if (this->m_aggregates)
+    std::fill(this->m_aggregates, this->m_aggregates + child_node_count,
+              KeyAggregate());
+};
+
+Node::~Node() { delete[] m_page; };
+
+Node::Node(int block_id, const PagedFile &file)
+    : id(block_id), m_page(new char[file.page_size()]),
+      m_page_size(file.page_size()) {
+  file.read_page(block_id, this->m_page);
+  this->m_header = reinterpret_cast<NodeHeader *>(this->m_page);
+  auto key_size = this->m_header->key_size;
+  if (key_size == 0 || key_size % alignof(NodeRecords) != 0 ||
+      this->m_header->degree > max_record_count(this->m_page_size, key_size) ||
+      this->m_header->size > this->m_header->degree + 1 ||
+      this->m_header->payload_size > MAX_PAYLOAD_SIZE ||
+      this->bind_page() > this->m_page_size)
+    throw std::runtime_error("Corrupted index page " +
+                             std::to_string(block_id) + ".");
 }
 
-size_t Node::max_record_count(size_t block_size) {
-  auto header_size = 1 + 2 + 2;
-  auto key_size = 4;
-  auto node_record_size = 1 + IN_BLOCK_RECORDS * (4 + 2) + 1 + 4;
-  auto m_next_size = 1 + 4;
-  // block_size >= header_size + key_size * N + node_record_size * (N+1) +
-  // m_next_size N * (key_size + node_record_size) <= block_size - header_size -
-  // node_record_size - m_next_size Hence:
-  return (block_size - header_size - node_record_size - m_next_size) /
-         (key_size + node_record_size);
+size_t Node::bind_page() {
+  auto keys_offset = sizeof(NodeHeader);
+  auto degree = this->m_header->degree;
+  auto values_offset = keys_offset + this->m_header->key_size * degree;
+  static_assert(alignof(NodePointer) <= alignof(NodeRecords),
+                "Key sizes that align NodeRecords align all values.");
+  this->m_keys = this->m_page + keys_offset;
+  if (this->m_header->is_leaf) {
+    this->m_record_values =
+        reinterpret_cast<NodeRecords *>(this->m_page + values_offset);
+    return values_offset + sizeof(NodeRecords) * degree;
+  }
+  this->m_node_values =
+      reinterpret_cast<NodePointer *>(this->m_page + values_offset);
+  auto end = values_offset + sizeof(NodePointer) * (degree + 1);
+  if (!this->m_header->has_aggregates)
+    return end;
+  auto aggregates_offset = ceil_div(end, alignof(KeyAggregate)) *
+                           alignof(KeyAggregate);
+  this->m_aggregates =
+      reinterpret_cast<KeyAggregate *>(this->m_page + aggregates_offset);
+  return aggregates_offset + sizeof(KeyAggregate) * (degree + 1);
+}
+
+static_assert(sizeof(NodeRecords) >=
+                  sizeof(NodePointer) + sizeof(KeyAggregate) + 8,
+              "Leaves must not be smaller than aggregated internal nodes.");
+
+size_t Node::max_record_count(size_t block_size, size_t key_size) {
+  // Leaves are the larger of the layouts, as a NodeRecords takes more than
+  // a NodePointer and KeyAggregate together:
+  // block_size >= header_size + N * (key_size + node_record_size)
+  auto header_size = sizeof(NodeHeader);
+  auto node_record_size = sizeof(NodeRecords);
+  return (block_size - header_size) / (key_size + node_record_size);
 }
 
 // NOTE: create_in_storage takes over ownership of the node pointer.
-NodePointer create_in_storage(Storage *storage, Node *node) {
-  return NodePointer(storage->track_new_index_block(node));
+NodeRef create_in_storage(Storage *storage, Node *node) {
+  return storage->track_new_index_block(node);
 }
 
-Node *fetch_from_storage(Storage *storage, NodePointer ptr) {
+NodeRef fetch_from_storage(Storage *storage, NodePointer ptr) {
   return storage->get_index_block(ptr.block_id);
 }
 
 size_t Node::key_count() const {
-  if (this->m_is_leaf)
-    return this->m_size;
-  return this->m_size - 1;
+  if (this->m_header->is_leaf)
+    return this->m_header->size;
+  return this->m_header->size - 1;
 }
 
-float Node::key_at(int index) const {
-  if (this->m_is_leaf)
-    assert(index < m_size);
-  if (!this->m_is_leaf)
-    assert(index < m_size - 1);
-  return this->m_keys[index];
+std::vector<RecordPointer> Node::records_at(Storage *storage, int index) const {
+  std::vector<RecordPointer> records;
+  this->append_records_at(storage, index, records);
+  return records;
 }
 
-size_t Node::search_key(float key) const {
-  if (this->m_is_leaf)
-    return std::lower_bound(this->m_keys, this->m_keys + this->key_count(),
-                            key) -
-           this->m_keys;
-  return std::upper_bound(this->m_keys, this->m_keys + this->key_count(), key) -
-         this->m_keys;
+PostingCursor Node::records_cursor(Storage *storage, int index) const {
+  assert(this->m_header->is_leaf);
+  assert(index < m_header->size);
+  return PostingCursor(storage, this->m_record_values[index]);
 }
 
-std::vector<RecordPointer> Node::records_at(Storage *storage, int index) const {
-  assert(this->m_is_leaf);
-  assert(index < m_size);
-  std::vector<RecordPointer> records;
+size_t Node::record_count_at(int index) const {
+  assert(this->m_header->is_leaf);
+  assert(index < m_header->size);
+  return this->m_record_values[index].count;
+}
 
-  auto record_values = this->m_record_values[index];
-  auto count = record_values.record_count;
-  assert(count <= IN_BLOCK_RECORDS);
-  for (auto i = 0; i < count; ++i)
-    records.push_back(record_values.records[i]);
-  // Follow overflow blocks.
-  auto overflow_block = record_values.more_records;
-  for (auto i = 0; i <= MAX_OVERFLOW_BLOCKS && overflow_block.has_value();
-       ++i) {
-    assert(i != MAX_OVERFLOW_BLOCKS);
-    auto block = storage->get_overflow_block(overflow_block.value().block_id);
-    for (auto j = 0; j < block->records.size(); ++j)
-      records.push_back(block->records[j]);
-    overflow_block = block->next;
-  }
-  return records;
+void Node::append_records_at(Storage *storage, int index,
+                             std::vector<RecordPointer> &records) const {
+  auto cursor = this->records_cursor(storage, index);
+  RecordPointer record;
+  while (cursor.next(record))
+    records.push_back(record);
 }
 
 size_t Node::leaf_entry_count() const {
-  assert(this->m_is_leaf);
-  return this->m_size;
+  assert(this->m_header->is_leaf);
+  return this->m_header->size;
 }
 
-Node *Node::child_node_at(Storage *storage, int index) const {
-  assert(!this->m_is_leaf);
+NodeRef Node::child_node_at(Storage *storage, int index) const {
+  assert(!this->m_header->is_leaf);
   return fetch_from_storage(storage, this->m_node_values[index]);
 }
 
-size_t Node::child_node_count() const {
-  assert(!this->m_is_leaf);
-  return this->m_size;
+NodePointer Node::child_pointer_at(int index) const {
+  assert(!this->m_header->is_leaf);
+  assert(index < m_header->size);
+  return this->m_node_values[index];
 }
 
-std::optional<Node::CreatedSibling> Node::insert(Storage *storage, float key,
-                                                 RecordPointer record) {
-  if (m_is_leaf)
-    return insert_leaf(storage, key, record);
-  return insert_internal(storage, key, record);
+size_t Node::child_node_count() const {
+  assert(!this->m_header->is_leaf);
+  return this->m_header->size;
 }
 
-std::optional<Node::CreatedSibling>
-Node::insert_leaf(Storage *storage, float key, RecordPointer record) {
-  assert(m_is_leaf);
-  auto keys_end = m_keys + m_size;
-  auto it = std::lower_bound(m_keys, keys_end, key);
-  auto key_position = it - m_keys;
-  if (it != keys_end && *it == key) {
-    // For existing keys, just push back.
-    m_record_values[key_position].push_back(storage, record);
-    return {};
-  }
-  if (m_size < m_degree) {
-    // If we can still fit the key, insert it to the correct location.
-    for (auto i = m_size - 1; i >= key_position; --i) {
-      // Push every entry back.
-      m_keys[i + 1] = m_keys[i];
-      m_record_values[i + 1] = m_record_values[i];
-    }
-    m_keys[key_position] = key;
-    m_record_values[key_position].clear();
-    m_record_values[key_position].push_back(storage, record);
-    ++m_size;
-    return {};
-  }
-  // Otherwise, split into two nodes.
-  return split_leaf_child(storage, key, record);
+const KeyAggregate &Node::child_aggregate(int index) const {
+  assert(this->m_aggregates);
+  assert(index < m_header->size);
+  return this->m_aggregates[index];
 }
 
-std::optional<Node::CreatedSibling>
-Node::insert_internal(Storage *storage, float key, RecordPointer record) {
-  assert(!this->m_is_leaf);
-  auto key_position = 0;
-  while (key_position < m_size - 1 && this->m_keys[key_position] <= key) {
-    ++key_position;
-  }
-  Node *child_for_key =
-      fetch_from_storage(storage, m_node_values[key_position]);
-  auto optional_new_child = child_for_key->insert(storage, key, record);
-  if (!optional_new_child.has_value()) {
-    return {};
-  }
-  // Insert the new node due to overflow into ourselves.
-  auto [new_child_node, new_child_key] = optional_new_child.value();
-  if (m_size < m_degree + 1) {
-    int i;
-    for (i = m_size - 2; i >= 0 && m_keys[i] > new_child_key; --i) {
-      m_keys[i + 1] = m_keys[i];
-      m_node_values[i + 2] = m_node_values[i + 1];
-    }
-    ++i;
-    m_keys[i] = new_child_key;
-    m_node_values[i + 1] = new_child_node;
-    ++m_size;
-    return {};
-  }
-  return split_internal_child(storage, new_child_key, new_child_node);
-};
+void Node::set_child_aggregate(int index, const KeyAggregate &aggregate) {
+  assert(this->m_aggregates);
+  assert(index < m_header->size);
+  this->m_aggregates[index] = aggregate;
+}
 
-Node::CreatedSibling Node::split_leaf_child(Storage *storage, float key,
-                                            RecordPointer record) {
-  assert(this->m_is_leaf);
-  Node *sibling = new Node(this->m_degree, true);
-  sibling->m_next = this->m_next;
-  auto sibling_pointer = create_in_storage(storage, sibling);
-  this->m_next = sibling_pointer;
-
-  int split_index = ceil_div(this->m_degree + 1, 2);
-  if (key > m_keys[split_index - 1]) {
-    // New record should go in second node.
-    for (int i = split_index; i < m_size; ++i) {
-      sibling->m_keys[i - split_index] = m_keys[i];
-      sibling->m_record_values[i - split_index] = m_record_values[i];
-      this->m_keys[i] = 0;
-      this->m_record_values[i].clear();
-    }
-    sibling->m_size = this->m_size - split_index;
-    this->m_size = split_index;
-    auto new_child = sibling->insert_leaf(storage, key, record);
-    // Sibling should have enough space to not create a child.
-    assert(!new_child.has_value());
-    return {.node = sibling_pointer, .key = sibling->m_keys[0]};
-  }
+Node *Node::create_empty_internal_node(int degree, size_t key_size,
+                                       size_t page_size, bool has_aggregates) {
+  return new Node(degree, key_size, 0, page_size, false, has_aggregates);
+}
 
-  // New record should go in ourselves.
-  --split_index;
-  for (int i = split_index; i < m_size; ++i) {
-    sibling->m_keys[i - split_index] = m_keys[i];
-    sibling->m_record_values[i - split_index] = m_record_values[i];
-    m_keys[i] = 0;
-    m_record_values[i].clear();
-  }
-  sibling->m_size = m_size - split_index;
-  this->m_size = split_index;
-  auto new_child = this->insert_leaf(storage, key, record);
-  // We should now have enough space to not create a child.
-  assert(!new_child.has_value());
-  assert(this->m_keys[0] < sibling->m_keys[0]);
-  return {.node = sibling_pointer, .key = sibling->m_keys[0]};
-};
+void Node::set_next_node(NodePointer next) {
+  assert(m_header->is_leaf);
+  m_header->next = next.block_id;
+}
 
-Node::CreatedSibling Node::split_internal_child(Storage *storage, float key,
-                                                NodePointer record) {
-  assert(!this->m_is_leaf);
-  Node *sibling = new Node(m_degree, false);
-  int split_index = ceil_div(m_degree, 2);
-  Node *insert_target_after_split = sibling;
-  assert(key != m_keys[split_index - 1]);
-  if (key < m_keys[split_index - 1]) {
-    insert_target_after_split = this;
-    --split_index;
-  }
-  // Move keys and node values.
-  std::copy(this->m_keys + split_index, this->m_keys + m_size - 1,
-            sibling->m_keys);
-  std::fill(this->m_keys + split_index, this->m_keys + m_size - 1, 0);
-  std::copy(this->m_node_values + split_index + 1, this->m_node_values + m_size,
-            sibling->m_node_values);
-  std::fill(this->m_node_values + split_index + 1, this->m_node_values + m_size,
-            NodePointer(-1));
-  // Update size and insert into the right location.
-  sibling->m_size = m_size - split_index - 1;
-  this->m_size = split_index + 1;
-  if (insert_target_after_split == sibling) {
-    auto i = sibling->m_size - 1;
-    while (i >= 0 && sibling->m_keys[i] > key) {
-      sibling->m_keys[i + 1] = sibling->m_keys[i];
-      sibling->m_node_values[i + 1] = sibling->m_node_values[i];
-      i--;
-    }
-    sibling->m_keys[i + 1] = key;
-    sibling->m_node_values[i + 1] = record;
-    ++sibling->m_size;
-  } else {
-    auto i = split_index - 1;
-    while (i >= 0 && m_keys[i] > key) {
-      m_keys[i + 1] = m_keys[i];
-      m_node_values[i + 2] = m_node_values[i + 1];
-      i--;
-    }
-    this->m_keys[i + 1] = key;
-    this->m_node_values[i + 2] = record;
-    ++this->m_size;
-  }
-  assert(this->m_keys[this->m_size - 1] < sibling->m_keys[0]);
-  // shift all sibling keys by 1 to left and move left key up
-  float left_key = sibling->m_keys[0];
-  for (auto i = 0; i < sibling->m_size - 1; ++i) {
-    sibling->m_keys[i] = sibling->m_keys[i + 1];
-  }
-  return {.node = create_in_storage(storage, sibling), .key = left_key};
-};
@@ -1,128 +1,340 @@
 #ifndef NODE_H
 #define NODE_H
 
+#include "key_codec.h"
+#include "posting_list.h"
 #include "storage/storage.h"
+#include <algorithm>
 #include <assert.h>
+#include <cstdint>
+#include <limits>
 #include <optional>
+#include <shared_mutex>
+#include <type_traits>
 #include <vector>
 
-constexpr int IN_BLOCK_RECORDS = 8;
-constexpr int MAX_OVERFLOW_BLOCKS = 8;
-
-struct RecordPointer {
-  int block_id;
-  int offset;
-};
+// Bytes of encoded records held in each leaf entry.
+constexpr size_t INLINE_POSTING_BYTES = 35;
+// Overflow pages appended between those linked by skip pointers.
+constexpr int OVERFLOW_SKIP_STRIDE = 8;
 
 struct NodePointer {
   int block_id;
 
   NodePointer() : block_id(-1) {};
   NodePointer(int block_id) : block_id(block_id) {};
-  NodePointer(std::istream &stream);
-  int serialize(std::ostream &stream) const;
 };
 
 struct OverflowBlockPointer {
   int block_id;
 };
 
+// Points to a page further along an overflow chain, along with its first
+// record when the pointer was set. Records only ever move to the front of a
+// page, so its first record can only decrease and following the pointer to
+// look for a record at or after that bound never skips past it.
+struct SkipPointer {
+  int block_id;
+  RecordPointer first;
+};
+
+// Continues the posting list of a key past its leaf entry. Each page in the
+// chain holds larger records than the one before.
 struct OverflowBlock {
   int id = -1;
-  std::vector<RecordPointer> records{};
+  PostingRun records{};
   std::optional<OverflowBlockPointer> next{};
+  std::optional<SkipPointer> skip{};
 
   OverflowBlock() {};
   OverflowBlock(int block_id, std::istream &stream);
   int serialize(std::ostream &stream) const;
-  static size_t max_record_count(size_t block_size);
+  // Bytes of encoded records that fit in a page.
+  static size_t max_encoded_size(size_t block_size);
 };
 
+// Records of a single key in a leaf. This is stored in the leaf page as-is.
+// The posting list starts with the smallest records encoded inline and goes
+// on in the overflow chain.
 struct NodeRecords {
-  int record_count;
-  RecordPointer records[IN_BLOCK_RECORDS];
-  std::optional<OverflowBlockPointer> more_records;
+  // First and last overflow blocks holding more records, or -1.
+  int32_t more_records;
+  int32_t last_block;
+  // Last page appended whose skip pointer is still unset, and the number of
+  // pages appended since.
+  int32_t skip_from;
+  uint8_t pages_since_skip;
+  // Bytes and records encoded inline.
+  uint8_t encoded_size;
+  uint16_t record_count;
+  // Records in the whole posting list.
+  uint32_t count;
+  // Bytes of payload after each record.
+  uint8_t payload_size;
+  uint8_t encoded[INLINE_POSTING_BYTES];
 
-  NodeRecords() {};
-  NodeRecords(std::istream &stream);
-  int serialize(std::ostream &stream) const;
-  void clear();
-  void push_back(Storage *storage, RecordPointer ptr);
+  void clear(size_t payload_size);
+  // Inserts record and its payload into the posting list, keeping it sorted.
+  // Appending to the end goes straight to the last page, anywhere else
+  // follows skip pointers.
+  void insert(Storage *storage, RecordPointer record, const uint8_t *payload);
+  PostingDecoder decoder() const {
+    return {this->encoded, this->record_count, this->payload_size};
+  };
+
+private:
+  PostingRun inline_run() const;
+  void set_inline_run(const PostingRun &run);
+  // Finds the run that record goes into: the last one whose first record is
+  // not after it. target is left empty for the inline run. next is the page
+  // after the run, if any.
+  void find_run(Storage *storage, RecordPointer record,
+                BlockRef<OverflowBlock> &target,
+                BlockRef<OverflowBlock> &next) const;
+  // Records a page appended to the end of the chain.
+  void append_block(Storage *storage, const BlockRef<OverflowBlock> &block);
 };
+static_assert(std::is_trivially_copyable_v<NodeRecords>,
+              "NodeRecords must be stored in pages as-is.");
+
+// Streams the records of a key, decoding the leaf entry and then each
+// overflow page as it is reached. The leaf must stay latched while in use.
+class PostingCursor {
+public:
+  PostingCursor(Storage *storage, const NodeRecords &records);
+
+  // Decodes the next record into record. Returns false after the last one.
+  bool next(RecordPointer &record);
+  // Payload of the record last decoded, valid until the cursor moves on.
+  const uint8_t *payload() const { return this->m_decoder.payload(); };
+  // Moves forward to the first record not before target and decodes it into
+  // record, skipping over whole pages where possible. Returns false if there
+  // is none.
+  bool seek(RecordPointer target, RecordPointer &record);
+
+private:
+  void enter_block(int id);
+
+  Storage *m_storage;
+  PostingDecoder m_decoder;
+  // Overflow page being decoded, kept pinned.
+  BlockRef<OverflowBlock> m_block;
+  int m_next_block;
+};
+
+// COUNT, SUM, MIN and MAX of the keys of the records in a subtree, which the
+// internal nodes of an aggregated tree keep for each of their children. This
+// is stored in the page as-is.
+struct KeyAggregate {
+  uint64_t count = 0;
+  double sum = 0;
+  double min = std::numeric_limits<double>::infinity();
+  double max = -std::numeric_limits<double>::infinity();
+
+  // Aggregate of count records of the given key.
+  static KeyAggregate of(double key, uint64_t count) {
+    return {count, key * count, key, key};
+  };
+  double average() const { return count ? sum / count : 0; };
+  void merge(const KeyAggregate &other) {
+    this->count += other.count;
+    this->sum += other.sum;
+    this->min = std::min(this->min, other.min);
+    this->max = std::max(this->max, other.max);
+  };
+};
+static_assert(std::is_trivially_copyable_v<KeyAggregate>,
+              "KeyAggregate must be stored in pages as-is.");
+
+int ceil_div(int a, int b);
+int floor_div(int a, int b);
 
 class Node;
-NodePointer create_in_storage(Storage *storage, Node *node);
-Node *fetch_from_storage(Storage *storage, NodePointer ptr);
+using NodeRef = BlockRef<Node>;
+NodeRef create_in_storage(Storage *storage, Node *node);
+NodeRef fetch_from_storage(Storage *storage, NodePointer ptr);
+
+// Header at the start of every index page.
+struct NodeHeader {
+  uint8_t is_leaf;
+  // Size of a key in bytes, which decides where the values start.
+  uint8_t key_size;
+  uint16_t degree;
+  uint16_t size;
+  // Bytes of payload carried with each record of a leaf.
+  uint8_t payload_size;
+  // Whether internal nodes keep a KeyAggregate for each child.
+  uint8_t has_aggregates;
+  // Next leaf, or -1. Unused for internal nodes.
+  int32_t next;
+  int32_t reserved3;
+};
+static_assert(sizeof(NodeHeader) == 16, "NodeHeader must be 16 bytes.");
 
+// A node is stored as a fixed layout page which is used in memory as-is:
+//   NodeHeader | Key keys[degree] | values
+// where the values are NodeRecords[degree] for leaves and
+// NodePointer[degree + 1] for internal nodes, followed in aggregated trees by
+// KeyAggregate[degree + 1] (8-byte aligned). Reading a node is thus a single
+// page read with no decoding, and searches run directly on the page.
+//
+// The functions taking or returning keys are templates on the key type, which
+// must match the key size the node was created with. See key_codec.h for the
+// key types supported.
 class Node {
 public:
   // Create empty leaf node.
-  Node(int degree) : Node(degree, true) {};
-  // Create internal node.
-  Node(int degree, NodePointer a, float key, NodePointer b);
+  Node(int degree, size_t key_size, size_t payload_size, size_t page_size)
+      : Node(degree, key_size, payload_size, page_size, true, false) {};
+  // Create internal node. The aggregates of its children start out empty.
+  template <typename Key>
+  Node(int degree, size_t page_size, NodePointer a, Key key, NodePointer b,
+       bool has_aggregates);
   ~Node();
 
-  Node(int block_id, std::istream &stream);
+  Node(const Node &) = delete;
+  Node &operator=(const Node &) = delete;
+
+  // Read the node from its page.
+  Node(int block_id, const PagedFile &file);
+
+  static constexpr bool FIXED_LAYOUT = true;
+  const char *page_data() const { return this->m_page; };
+  size_t page_size() const { return this->m_page_size; };
+
+  // Guards the page while the node is in memory: readers hold it shared,
+  // inserts exclusively. It is only taken while the node is pinned, so it is
+  // never held on a node that gets evicted.
+  std::shared_mutex &latch() const { return this->m_latch; };
 
   int id = -1;
-  int serialize(std::ostream &stream) const;
 
-  static size_t max_record_count(size_t block_size);
+  static size_t max_record_count(size_t block_size, size_t key_size);
+  template <typename Key> static size_t max_record_count(size_t block_size) {
+    return max_record_count(block_size, KeyCodec<Key>::SIZE);
+  };
 
-  struct CreatedSibling {
+  template <typename Key> struct CreatedSibling {
     NodePointer node;
-    float key;
+    Key key;
   };
 
-  // Inserts the provided record into self. If it is not possible to fit in the
-  // current node, the sibling node created will be returned.
-  std::optional<CreatedSibling> insert(Storage *storage, float key,
-                                       RecordPointer record);
-
-  inline bool is_leaf() const { return this->m_is_leaf; };
-  inline Node *next_node(Storage *storage) const {
-    assert(this->m_is_leaf);
-    return this->m_next.has_value()
-               ? fetch_from_storage(storage, this->m_next.value())
-               : nullptr;
+  // Inserts the provided record, with payload_size() bytes of payload, into
+  // this leaf. If it is not possible to fit in the current node, the sibling
+  // node created will be returned.
+  template <typename Key>
+  std::optional<CreatedSibling<Key>> insert(Storage *storage, Key key,
+                                            RecordPointer record,
+                                            const uint8_t *payload);
+  // Inserts a child created by splitting one of the children of this internal
+  // node, returning the sibling created if this node splits in turn.
+  template <typename Key>
+  std::optional<CreatedSibling<Key>> insert_child(Storage *storage, Key key,
+                                                  NodePointer child);
+  // Whether inserting key (or a child, for internal nodes) cannot split this
+  // node, so that a split below stops here.
+  template <typename Key> bool can_insert_without_split(Key key) const;
+
+  // Bulk loading appends entries in ascending key order without searching.
+  static Node *create_empty_internal_node(int degree, size_t key_size,
+                                          size_t page_size,
+                                          bool has_aggregates);
+  // Appends to a leaf. A key equal to the last key adds to its records.
+  template <typename Key>
+  void bulk_append(Storage *storage, Key key, RecordPointer record,
+                   const uint8_t *payload);
+  // Appends a child to an internal node. The key separates it from the
+  // previous child and is ignored for the first one.
+  template <typename Key> void bulk_append_child(Key key, NodePointer child);
+  void set_next_node(NodePointer next);
+
+  inline bool is_leaf() const { return this->m_header->is_leaf; };
+  size_t payload_size() const { return this->m_header->payload_size; };
+  // Also reads ahead along the leaf chain past the returned leaf. Readers
+  // call this with the leaf latched, which keeps the next pointer stable.
+  inline NodeRef next_node(Storage *storage) const {
+    assert(this->is_leaf());
+    if (this->m_header->next < 0)
+      return NodeRef();
+    auto next = fetch_from_storage(storage, this->m_header->next);
+    storage->read_ahead_leaves(this->m_header->next);
+    return next;
+  };
+  // Next leaf, or -1 after the last one.
+  inline NodePointer next_node_pointer() const {
+    assert(this->is_leaf());
+    return this->m_header->next;
   };
 
   size_t key_count() const;
-  float key_at(int index) const;
+  template <typename Key> Key key_at(int index) const;
   // Returns the index where the smallest value that is larger or equal to the
   // key is located. For internal nodes, this returns the index of the node
   // where the key can likely be found. For leaf nodes, this returns where the
   // key is.
-  size_t search_key(float key) const;
+  template <typename Key> size_t search_key(Key key) const;
 
   std::vector<RecordPointer> records_at(Storage *storage, int index) const;
+  // Streams the records of the key at index as they are decoded.
+  PostingCursor records_cursor(Storage *storage, int index) const;
+  // Number of records of the key at index.
+  size_t record_count_at(int index) const;
+  // Appends the records of the key at index to records, following its
+  // overflow chain once.
+  void append_records_at(Storage *storage, int index,
+                         std::vector<RecordPointer> &records) const;
   size_t leaf_entry_count() const;
 
-  Node *child_node_at(Storage *storage, int index) const;
+  NodeRef child_node_at(Storage *storage, int index) const;
+  NodePointer child_pointer_at(int index) const;
   size_t child_node_count() const;
 
+  // Internal nodes of aggregated trees keep the aggregate of each child's
+  // subtree. Adding or moving children moves their aggregates along, but the
+  // aggregate of a new or changed child is up to the caller to set.
+  bool has_aggregates() const { return this->m_header->has_aggregates; };
+  const KeyAggregate &child_aggregate(int index) const;
+  void set_child_aggregate(int index, const KeyAggregate &aggregate);
+  // Aggregate of every record below this node, from the entries of a leaf or
+  // the child aggregates of an internal node. Key must be arithmetic.
+  template <typename Key> KeyAggregate subtree_aggregate() const;
+
 private:
-  Node(int degree, bool is_leaf);
-  static Node create_empty_internal_node();
-
-  std::optional<CreatedSibling> insert_leaf(Storage *storage, float key,
-                                            RecordPointer record);
-  std::optional<CreatedSibling> insert_internal(Storage *storage, float key,
-                                                RecordPointer record);
-
-  CreatedSibling split_leaf_child(Storage *storage, float key,
-                                  RecordPointer record);
-  CreatedSibling split_internal_child(Storage *storage, float key,
-                                      NodePointer record);
-
-  bool m_is_leaf = 0;
-  int m_degree = 0;
-  int m_size = 0;
-
-  float *m_keys;
-  NodePointer *m_node_values;
-  NodeRecords *m_record_values;
-  std::optional<NodePointer> m_next;
+  Node(int degree, size_t key_size, size_t payload_size, size_t page_size,
+       bool is_leaf, bool has_aggregates);
+  // Points the key and value arrays into the page based on its header,
+  // returning the bytes of the page they take up.
+  size_t bind_page();
+  template <typename Key> Key *keys() const {
+    assert(sizeof(Key) == this->m_header->key_size);
+    return reinterpret_cast<Key *>(this->m_keys);
+  };
+
+  template <typename Key>
+  std::optional<CreatedSibling<Key>> insert_leaf(Storage *storage, Key key,
+                                                 RecordPointer record,
+                                                 const uint8_t *payload);
+
+  template <typename Key>
+  CreatedSibling<Key> split_leaf_child(Storage *storage, Key key,
+                                       RecordPointer record,
+                                       const uint8_t *payload);
+  template <typename Key>
+  CreatedSibling<Key> split_internal_child(Storage *storage, Key key,
+                                           NodePointer record);
+
+  char *m_page;
+  size_t m_page_size;
+  mutable std::shared_mutex m_latch;
+
+  // Views into m_page.
+  NodeHeader *m_header;
+  char *m_keys;
+  NodePointer *m_node_values = nullptr;
+  NodeRecords *m_record_values = nullptr;
+  KeyAggregate *m_aggregates = nullptr;
 };
 
+#include "node_impl.h"
+
 #endif // NODE_H
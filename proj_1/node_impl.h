@@ -0,0 +1,275 @@
+#ifndef NODE_IMPL_H
+#define NODE_IMPL_H
+
+// Node functions that depend on the key type. Included by node.h.
+
+// Internal node creation.
+template <typename Key>
+Node::Node(int degree, size_t page_size, NodePointer a, Key key, NodePointer b,
+           bool has_aggregates)
+    : Node(degree, KeyCodec<Key>::SIZE, 0, page_size, false, has_aggregates) {
+  assert(degree > 2);
+  this->keys<Key>()[0] = key;
+  this->m_node_values[0] = a;
+  this->m_node_values[1] = b;
+  m_header->size = 2;
+}
+
+template <typename Key> Key Node::key_at(int index) const {
+  if (this->m_header->is_leaf)
+    assert(index < m_header->size);
+  if (!this->m_header->is_leaf)
+    assert(index < m_header->size - 1);
+  return this->keys<Key>()[index];
+}
+
+template <typename Key> size_t Node::search_key(Key key) const {
+  if (this->m_header->is_leaf)
+    return KeyCodec<Key>::count_less(this->keys<Key>(), this->key_count(), key);
+  return KeyCodec<Key>::count_less_equal(this->keys<Key>(), this->key_count(),
+                                         key);
+}
+
+template <typename Key>
+std::optional<Node::CreatedSibling<Key>>
+Node::insert(Storage *storage, Key key, RecordPointer record,
+             const uint8_t *payload) {
+  assert(m_header->is_leaf);
+  return insert_leaf(storage, key, record, payload);
+}
+
+template <typename Key> bool Node::can_insert_without_split(Key key) const {
+  if (!m_header->is_leaf)
+    return m_header->size < m_header->degree + 1;
+  if (m_header->size < m_header->degree)
+    return true;
+  // Records of an existing key go to its overflow chain.
+  int key_position = this->search_key(key);
+  return key_position < m_header->size &&
+         this->keys<Key>()[key_position] == key;
+}
+
+template <typename Key>
+void Node::bulk_append(Storage *storage, Key key, RecordPointer record,
+                       const uint8_t *payload) {
+  assert(m_header->is_leaf);
+  auto keys = this->keys<Key>();
+  if (m_header->size > 0 && keys[m_header->size - 1] == key) {
+    m_record_values[m_header->size - 1].insert(storage, record, payload);
+  } else {
+    assert(m_header->size < m_header->degree);
+    assert(m_header->size == 0 || keys[m_header->size - 1] < key);
+    keys[m_header->size] = key;
+    m_record_values[m_header->size].clear(m_header->payload_size);
+    m_record_values[m_header->size].insert(storage, record, payload);
+    ++m_header->size;
+  }
+  storage->mark_index_block_dirty(this->id);
+}
+
+template <typename Key>
+void Node::bulk_append_child(Key key, NodePointer child) {
+  assert(!m_header->is_leaf);
+  auto keys = this->keys<Key>();
+  assert(m_header->size < m_header->degree + 1);
+  if (m_header->size > 0) {
+    assert(m_header->size == 1 || keys[m_header->size - 2] < key);
+    keys[m_header->size - 1] = key;
+  }
+  m_node_values[m_header->size] = child;
+  ++m_header->size;
+}
+
+template <typename Key>
+std::optional<Node::CreatedSibling<Key>>
+Node::insert_leaf(Storage *storage, Key key, RecordPointer record,
+                  const uint8_t *payload) {
+  assert(m_header->is_leaf);
+  auto keys = this->keys<Key>();
+  int key_position = this->search_key(key);
+  if (key_position < m_header->size && keys[key_position] == key) {
+    // For existing keys, add to their posting list.
+    m_record_values[key_position].insert(storage, record, payload);
+    storage->mark_index_block_dirty(this->id);
+    return {};
+  }
+  if (m_header->size < m_header->degree) {
+    // If we can still fit the key, insert it to the correct location.
+    for (auto i = m_header->size - 1; i >= key_position; --i) {
+      // Push every entry back.
+      keys[i + 1] = keys[i];
+      m_record_values[i + 1] = m_record_values[i];
+    }
+    keys[key_position] = key;
+    m_record_values[key_position].clear(m_header->payload_size);
+    m_record_values[key_position].insert(storage, record, payload);
+    ++m_header->size;
+    storage->mark_index_block_dirty(this->id);
+    return {};
+  }
+  // Otherwise, split into two nodes.
+  return split_leaf_child(storage, key, record, payload);
+}
+
+template <typename Key>
+std::optional<Node::CreatedSibling<Key>>
+Node::insert_child(Storage *storage, Key key, NodePointer child) {
+  assert(!this->m_header->is_leaf);
+  auto keys = this->keys<Key>();
+  if (m_header->size < m_header->degree + 1) {
+    int i;
+    for (i = m_header->size - 2; i >= 0 && keys[i] > key; --i) {
+      keys[i + 1] = keys[i];
+      m_node_values[i + 2] = m_node_values[i + 1];
+      if (m_aggregates)
+        m_aggregates[i + 2] = m_aggregates[i + 1];
+    }
+    ++i;
+    keys[i] = key;
+    m_node_values[i + 1] = child;
+    if (m_aggregates)
+      m_aggregates[i + 1] = KeyAggregate();
+    ++m_header->size;
+    storage->mark_index_block_dirty(this->id);
+    return {};
+  }
+  return split_internal_child(storage, key, child);
+}
+
+template <typename Key>
+Node::CreatedSibling<Key>
+Node::split_leaf_child(Storage *storage, Key key, RecordPointer record,
+                       const uint8_t *payload) {
+  assert(this->m_header->is_leaf);
+  NodeRef sibling = create_in_storage(
+      storage, new Node(this->m_header->degree, KeyCodec<Key>::SIZE,
+                        this->m_header->payload_size, storage->block_size));
+  auto keys = this->keys<Key>();
+  auto sibling_keys = sibling->keys<Key>();
+  sibling->m_header->next = this->m_header->next;
+  auto sibling_pointer = NodePointer(sibling->id);
+  this->m_header->next = sibling_pointer.block_id;
+  storage->mark_index_block_dirty(this->id);
+
+  int split_index = ceil_div(this->m_header->degree + 1, 2);
+  if (key > keys[split_index - 1]) {
+    // New record should go in second node.
+    for (int i = split_index; i < m_header->size; ++i) {
+      sibling_keys[i - split_index] = keys[i];
+      sibling->m_record_values[i - split_index] = m_record_values[i];
+      keys[i] = Key{};
+      this->m_record_values[i].clear(m_header->payload_size);
+    }
+    sibling->m_header->size = this->m_header->size - split_index;
+    this->m_header->size = split_index;
+    auto new_child = sibling->insert_leaf(storage, key, record, payload);
+    // Sibling should have enough space to not create a child.
+    assert(!new_child.has_value());
+    return {.node = sibling_pointer, .key = sibling_keys[0]};
+  }
+
+  // New record should go in ourselves.
+  --split_index;
+  for (int i = split_index; i < m_header->size; ++i) {
+    sibling_keys[i - split_index] = keys[i];
+    sibling->m_record_values[i - split_index] = m_record_values[i];
+    keys[i] = Key{};
+    m_record_values[i].clear(m_header->payload_size);
+  }
+  sibling->m_header->size = m_header->size - split_index;
+  this->m_header->size = split_index;
+  auto new_child = this->insert_leaf(storage, key, record, payload);
+  // We should now have enough space to not create a child.
+  assert(!new_child.has_value());
+  assert(keys[0] < sibling_keys[0]);
+  return {.node = sibling_pointer, .key = sibling_keys[0]};
+}
+
+template <typename Key>
+Node::CreatedSibling<Key>
+Node::split_internal_child(Storage *storage, Key key, NodePointer record) {
+  assert(!this->m_header->is_leaf);
+  Node *sibling = Node::create_empty_internal_node(
+      m_header->degree, KeyCodec<Key>::SIZE, storage->block_size,
+      this->has_aggregates());
+  auto keys = this->keys<Key>();
+  auto sibling_keys = sibling->keys<Key>();
+  int split_index = ceil_div(m_header->degree, 2);
+  Node *insert_target_after_split = sibling;
+  storage->mark_index_block_dirty(this->id);
+  assert(key != keys[split_index - 1]);
+  if (key < keys[split_index - 1]) {
+    insert_target_after_split = this;
+    --split_index;
+  }
+  // Move keys and node values.
+  std::copy(keys + split_index, keys + m_header->size - 1, sibling_keys);
+  std::fill(keys + split_index, keys + m_header->size - 1, Key{});
+  std::copy(this->m_node_values + split_index + 1,
+            this->m_node_values + m_header->size, sibling->m_node_values);
+  std::fill(this->m_node_values + split_index + 1,
+            this->m_node_values + m_header->size, NodePointer(-1));
+  if (m_aggregates) {
+    std::copy(this->m_aggregates + split_index + 1,
+              this->m_aggregates + m_header->size, sibling->m_aggregates);
+    std::fill(this->m_aggregates + split_index + 1,
+              this->m_aggregates + m_header->size, KeyAggregate());
+  }
+  // Update size and insert into the right location.
+  sibling->m_header->size = m_header->size - split_index - 1;
+  this->m_header->size = split_index + 1;
+  if (insert_target_after_split == sibling) {
+    auto i = sibling->m_header->size - 1;
+    while (i >= 0 && sibling_keys[i] > key) {
+      sibling_keys[i + 1] = sibling_keys[i];
+      sibling->m_node_values[i + 1] = sibling->m_node_values[i];
+      if (m_aggregates)
+        sibling->m_aggregates[i + 1] = sibling->m_aggregates[i];
+      i--;
+    }
+    sibling_keys[i + 1] = key;
+    sibling->m_node_values[i + 1] = record;
+    if (m_aggregates)
+      sibling->m_aggregates[i + 1] = KeyAggregate();
+    ++sibling->m_header->size;
+  } else {
+    auto i = split_index - 1;
+    while (i >= 0 && keys[i] > key) {
+      keys[i + 1] = keys[i];
+      m_node_values[i + 2] = m_node_values[i + 1];
+      if (m_aggregates)
+        m_aggregates[i + 2] = m_aggregates[i + 1];
+      i--;
+    }
+    keys[i + 1] = key;
+    this->m_node_values[i + 2] = record;
+    if (m_aggregates)
+      this->m_aggregates[i + 2] = KeyAggregate();
+    ++this->m_header->size;
+  }
+  assert(keys[this->m_header->size - 1] < sibling_keys[0]);
+  // shift all sibling keys by 1 to left and move left key up
+  Key left_key = sibling_keys[0];
+  for (auto i = 0; i < sibling->m_header->size - 1; ++i) {
+    sibling_keys[i] = sibling_keys[i + 1];
+  }
+  return {.node = create_in_storage(storage, sibling)->id, .key = left_key};
+}
+
+template <typename Key> KeyAggregate Node::subtree_aggregate() const {
+  static_assert(std::is_arithmetic_v<Key>, "Only numbers are aggregated.");
+  KeyAggregate aggregate;
+  if (this->m_header->is_leaf) {
+    auto keys = this->keys<Key>();
+    for (auto i = 0; i < m_header->size; ++i)
+      aggregate.merge(
+          KeyAggregate::of(keys[i], this->m_record_values[i].count));
+    return aggregate;
+  }
+  assert(this->m_aggregates);
+  for (auto i = 0; i < m_header->size; ++i)
+    aggregate.merge(this->m_aggregates[i]);
+  return aggregate;
+}
+
+#endif // NODE_IMPL_H
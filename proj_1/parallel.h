@@ -0,0 +1,112 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Number of worker threads to use by default.
+inline int default_thread_count() {
+  return std::max(1, (int)std::thread::hardware_concurrency());
+}
+
+// Runs task(i) for every i in [0, thread_count), each on its own thread, the
+// first one on the calling thread. The first exception thrown by a task is
+// rethrown once all of them have finished.
+template <typename Task> void parallel_for(int thread_count, Task task) {
+  std::vector<std::exception_ptr> errors(thread_count);
+  auto run = [&](int i) {
+    try {
+      task(i);
+    } catch (...) {
+      errors[i] = std::current_exception();
+    }
+  };
+  std::vector<std::thread> workers;
+  for (int i = 1; i < thread_count; ++i)
+    workers.emplace_back(run, i);
+  if (thread_count > 0)
+    run(0);
+  for (auto &worker : workers)
+    worker.join();
+  for (auto &error : errors)
+    if (error)
+      std::rethrow_exception(error);
+}
+
+// Splits [0, count) into morsels of at most morsel_size and runs
+// task(thread, begin, end) for each of them on thread_count threads. Every
+// thread starts with an equal, contiguous share of the morsels and takes them
+// from the front; once it runs out it steals from the back of the other
+// threads' shares, so uneven morsels do not leave threads idle.
+template <typename Task>
+void parallel_morsels(size_t count, size_t morsel_size, int thread_count,
+                      Task task) {
+  struct Share {
+    std::mutex latch;
+    size_t next = 0;
+    size_t end = 0;
+  };
+  auto morsel_count = (count + morsel_size - 1) / morsel_size;
+  thread_count = std::max(1, std::min(thread_count, (int)morsel_count));
+  std::vector<Share> shares(thread_count);
+  for (int i = 0; i < thread_count; ++i) {
+    shares[i].next = morsel_count * i / thread_count;
+    shares[i].end = morsel_count * (i + 1) / thread_count;
+  }
+  auto run = [&](int thread, size_t morsel) {
+    auto begin = morsel * morsel_size;
+    task(thread, begin, std::min(count, begin + morsel_size));
+  };
+  parallel_for(thread_count, [&](int thread) {
+    auto &own = shares[thread];
+    while (true) {
+      std::unique_lock<std::mutex> lock(own.latch);
+      if (own.next == own.end)
+        break;
+      auto morsel = own.next++;
+      lock.unlock();
+      run(thread, morsel);
+    }
+    for (int i = 1; i < thread_count; ++i) {
+      auto &victim = shares[(thread + i) % thread_count];
+      while (true) {
+        std::unique_lock<std::mutex> lock(victim.latch);
+        if (victim.next == victim.end)
+          break;
+        auto morsel = --victim.end;
+        lock.unlock();
+        run(thread, morsel);
+      }
+    }
+  });
+}
+
+// Stable sort which sorts one chunk per thread and then merges neighbouring
+// chunks pairwise, also in parallel.
+template <typename T, typename Compare>
+void parallel_stable_sort(std::vector<T> &values, Compare compare,
+                          int thread_count) {
+  thread_count = std::max(1, std::min(thread_count, (int)values.size()));
+  std::vector<size_t> bounds;
+  for (int i = 0; i <= thread_count; ++i)
+    bounds.push_back(values.size() * i / thread_count);
+  auto begin = values.begin();
+  parallel_for(thread_count, [&](int i) {
+    std::stable_sort(begin + bounds[i], begin + bounds[i + 1], compare);
+  });
+  for (int width = 1; width < thread_count; width *= 2) {
+    auto merge_count = (thread_count + 2 * width - 1) / (2 * width);
+    parallel_for(merge_count, [&](int i) {
+      auto first = i * 2 * width;
+      auto middle = std::min(first + width, thread_count);
+      auto last = std::min(first + 2 * width, thread_count);
+      std::inplace_merge(begin + bounds[first], begin + bounds[middle],
+                         begin + bounds[last], compare);
+    });
+  }
+}
+
+#endif // PARALLEL_H
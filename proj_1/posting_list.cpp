@@ -0,0 +1,134 @@
+#include "posting_list.h"
+#include <algorithm>
+#include <assert.h>
+
+static uint8_t *write_varint(uint8_t *out, uint32_t value) {
+  while (value >= 0x80) {
+    *out++ = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  *out++ = (uint8_t)value;
+  return out;
+}
+
+static const uint8_t *read_varint(const uint8_t *in, uint32_t &value) {
+  value = 0;
+  for (int shift = 0;; shift += 7) {
+    auto byte = *in++;
+    value |= (uint32_t)(byte & 0x7F) << shift;
+    if (byte < 0x80)
+      return in;
+  }
+}
+
+// Encodes record following previous, then its payload, returning the end of
+// its encoding.
+static uint8_t *encode_record(uint8_t *out, RecordPointer previous,
+                              RecordPointer record, const uint8_t *payload,
+                              size_t payload_size) {
+  assert(!location_less(record, previous));
+  assert(record.offset >= 0);
+  assert(payload || payload_size == 0);
+  auto block_delta = (uint32_t)(record.block_id - previous.block_id);
+  out = write_varint(out, block_delta);
+  if (block_delta == 0)
+    out = write_varint(out, record.offset - previous.offset);
+  else
+    out = write_varint(out, record.offset);
+  return std::copy(payload, payload + payload_size, out);
+}
+
+bool PostingDecoder::next(RecordPointer &record) {
+  if (this->m_remaining == 0)
+    return false;
+  uint32_t block_delta, offset;
+  this->m_data = read_varint(this->m_data, block_delta);
+  this->m_data = read_varint(this->m_data, offset);
+  record.block_id = this->m_previous.block_id + (int)block_delta;
+  record.offset = (int)offset;
+  if (block_delta == 0)
+    record.offset += this->m_previous.offset;
+  this->m_payload = this->m_data;
+  this->m_data += this->m_payload_size;
+  this->m_previous = record;
+  --this->m_remaining;
+  return true;
+}
+
+PostingRun::PostingRun(const uint8_t *data, size_t size, uint32_t count,
+                       size_t payload_size)
+    : bytes(data, data + size), count(count), payload_size(payload_size) {
+  assert(payload_size <= MAX_PAYLOAD_SIZE);
+  auto decoder = this->decoder();
+  while (decoder.next(this->last))
+    ;
+  assert(decoder.position() == this->bytes.data() + size);
+}
+
+RecordPointer PostingRun::first() const {
+  assert(this->count > 0);
+  RecordPointer record;
+  this->decoder().next(record);
+  return record;
+}
+
+bool PostingRun::insert(RecordPointer record, const uint8_t *payload,
+                        size_t capacity) {
+  uint8_t encoded[2 * (MAX_ENCODED_RECORD_SIZE + MAX_PAYLOAD_SIZE)];
+  if (this->count == 0 || !location_less(record, this->last)) {
+    auto previous = this->count ? this->last : RecordPointer{0, 0};
+    auto size =
+        encode_record(encoded, previous, record, payload, this->payload_size) -
+        encoded;
+    if (this->bytes.size() + size > capacity)
+      return false;
+    this->bytes.insert(this->bytes.end(), encoded, encoded + size);
+    this->last = record;
+    ++this->count;
+    return true;
+  }
+  // Find the first record after the new one, which is then encoded relative
+  // to it. The records after that keep their encoding.
+  auto decoder = this->decoder();
+  RecordPointer previous{0, 0}, next;
+  auto next_start = decoder.position();
+  while (decoder.next(next) && !location_less(record, next)) {
+    previous = next;
+    next_start = decoder.position();
+  }
+  auto next_end = decoder.position();
+  auto end =
+      encode_record(encoded, previous, record, payload, this->payload_size);
+  end = encode_record(end, record, next, decoder.payload(), this->payload_size);
+  auto size = this->bytes.size() - (next_end - next_start) + (end - encoded);
+  if (size > capacity)
+    return false;
+  auto start = this->bytes.begin() + (next_start - this->bytes.data());
+  start = this->bytes.erase(start, start + (next_end - next_start));
+  this->bytes.insert(start, encoded, end);
+  ++this->count;
+  return true;
+}
+
+PostingRun PostingRun::split() {
+  std::vector<RecordPointer> records;
+  std::vector<const uint8_t *> payloads;
+  records.reserve(this->count);
+  payloads.reserve(this->count);
+  RecordPointer record;
+  auto decoder = this->decoder();
+  while (decoder.next(record)) {
+    records.push_back(record);
+    payloads.push_back(decoder.payload());
+  }
+  // Payloads point into this run until it is replaced.
+  PostingRun lower(this->payload_size), upper(this->payload_size);
+  auto middle = records.size() / 2;
+  for (size_t i = 0; i < records.size(); ++i) {
+    auto &half = i < middle ? lower : upper;
+    auto inserted = half.insert(records[i], payloads[i], SIZE_MAX);
+    assert(inserted);
+  }
+  *this = std::move(lower);
+  return upper;
+}
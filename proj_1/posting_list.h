@@ -0,0 +1,85 @@
+#ifndef POSTING_LIST_H
+#define POSTING_LIST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Posting lists hold the records of one key sorted by location, that is by
+// data block and then offset, and delta encoded as varints: each record is
+// the difference in block id from the previous record, followed by its
+// offset, or the difference in offset when both are in the same block. Records
+// of a key a few blocks apart then take two or three bytes rather than six.
+// Each record may be followed by a payload of a fixed size per list, such as
+// the included columns of a covering index, which is stored as-is.
+
+struct RecordPointer {
+  int block_id;
+  int offset;
+};
+
+inline bool location_less(RecordPointer a, RecordPointer b) {
+  return a.block_id != b.block_id ? a.block_id < b.block_id
+                                  : a.offset < b.offset;
+}
+
+inline bool same_location(RecordPointer a, RecordPointer b) {
+  return a.block_id == b.block_id && a.offset == b.offset;
+}
+
+// Largest encoding of a single record: two varints of up to five bytes.
+constexpr size_t MAX_ENCODED_RECORD_SIZE = 10;
+// Largest payload carried with each record.
+constexpr size_t MAX_PAYLOAD_SIZE = 16;
+
+// Streams the records of an encoded run one at a time.
+class PostingDecoder {
+public:
+  PostingDecoder() {};
+  PostingDecoder(const uint8_t *data, size_t count, size_t payload_size)
+      : m_data(data), m_remaining(count), m_payload_size(payload_size) {};
+
+  // Decodes the next record into record. Returns false at the end of the run.
+  bool next(RecordPointer &record);
+  // Payload of the record last decoded.
+  const uint8_t *payload() const { return this->m_payload; };
+  // Start of the encoding of the next record.
+  const uint8_t *position() const { return this->m_data; };
+
+private:
+  const uint8_t *m_data = nullptr;
+  const uint8_t *m_payload = nullptr;
+  size_t m_remaining = 0;
+  size_t m_payload_size = 0;
+  RecordPointer m_previous{0, 0};
+};
+
+// A sorted run of encoded records, as held by a leaf entry or overflow page.
+struct PostingRun {
+  std::vector<uint8_t> bytes{};
+  uint32_t count = 0;
+  uint8_t payload_size = 0;
+  // Largest record, so that appends need not decode the run. Only valid when
+  // count > 0.
+  RecordPointer last{0, 0};
+
+  // Decodes a run of count records.
+  PostingRun(const uint8_t *data, size_t size, uint32_t count,
+             size_t payload_size);
+  explicit PostingRun(size_t payload_size) : payload_size(payload_size) {};
+  PostingRun() {};
+
+  PostingDecoder decoder() const {
+    return {this->bytes.data(), this->count, this->payload_size};
+  };
+  RecordPointer first() const;
+  // Inserts record, followed by payload_size bytes of payload, after any
+  // equal ones. Appending only encodes the record, anywhere else only the
+  // record after it is re-encoded too. Returns false, leaving the run
+  // unchanged, if the run would exceed capacity bytes.
+  bool insert(RecordPointer record, const uint8_t *payload, size_t capacity);
+  // Moves the upper half of the records into a new run, which is returned.
+  PostingRun split();
+};
+
+#endif // POSTING_LIST_H
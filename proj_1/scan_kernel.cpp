@@ -0,0 +1,99 @@
+#include "scan_kernel.h"
+#include "simd.h"
+#include <algorithm>
+
+void RangeAggregate::merge(const RangeAggregate &other) {
+  this->count += other.count;
+  this->sum += other.sum;
+  this->min = std::min(this->min, other.min);
+  this->max = std::max(this->max, other.max);
+}
+
+// Sums are accumulated in float lanes for at most this many values before
+// being added to the double total, to bound the rounding error.
+constexpr size_t SUM_FLUSH_VALUES = 1024;
+
+#ifdef SIMD_SSE2
+// Horizontal reductions of the four lanes of a register.
+static float lane_sum(__m128 v) {
+  v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+  v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+  return _mm_cvtss_f32(v);
+}
+static float lane_min(__m128 v) {
+  v = _mm_min_ps(v, _mm_movehl_ps(v, v));
+  v = _mm_min_ss(v, _mm_shuffle_ps(v, v, 1));
+  return _mm_cvtss_f32(v);
+}
+static float lane_max(__m128 v) {
+  v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+  v = _mm_max_ss(v, _mm_shuffle_ps(v, v, 1));
+  return _mm_cvtss_f32(v);
+}
+#endif
+
+RangeAggregate aggregate_range(const float *values, size_t count, float lo,
+                               float hi) {
+  RangeAggregate result;
+  size_t i = 0;
+#ifdef __AVX2__
+  {
+    auto low = _mm256_set1_ps(lo), high = _mm256_set1_ps(hi);
+    auto mins = _mm256_set1_ps(result.min), maxs = _mm256_set1_ps(result.max);
+    while (count - i >= 8) {
+      auto sums = _mm256_setzero_ps();
+      auto end = i + std::min(count - i, SUM_FLUSH_VALUES) / 8 * 8;
+      for (; i < end; i += 8) {
+        auto v = _mm256_loadu_ps(values + i);
+        auto mask = _mm256_and_ps(_mm256_cmp_ps(v, low, _CMP_GE_OQ),
+                                  _mm256_cmp_ps(v, high, _CMP_LE_OQ));
+        result.count += popcount(_mm256_movemask_ps(mask));
+        sums = _mm256_add_ps(sums, _mm256_and_ps(mask, v));
+        mins = _mm256_min_ps(mins, _mm256_blendv_ps(mins, v, mask));
+        maxs = _mm256_max_ps(maxs, _mm256_blendv_ps(maxs, v, mask));
+      }
+      result.sum += lane_sum(_mm_add_ps(_mm256_castps256_ps128(sums),
+                                        _mm256_extractf128_ps(sums, 1)));
+    }
+    result.min = lane_min(_mm_min_ps(_mm256_castps256_ps128(mins),
+                                     _mm256_extractf128_ps(mins, 1)));
+    result.max = lane_max(_mm_max_ps(_mm256_castps256_ps128(maxs),
+                                     _mm256_extractf128_ps(maxs, 1)));
+  }
+#endif
+#ifdef SIMD_SSE2
+  {
+    auto low = _mm_set1_ps(lo), high = _mm_set1_ps(hi);
+    auto mins = _mm_set1_ps(result.min), maxs = _mm_set1_ps(result.max);
+    while (count - i >= 4) {
+      auto sums = _mm_setzero_ps();
+      auto end = i + std::min(count - i, SUM_FLUSH_VALUES) / 4 * 4;
+      for (; i < end; i += 4) {
+        auto v = _mm_loadu_ps(values + i);
+        auto mask = _mm_and_ps(_mm_cmpge_ps(v, low), _mm_cmple_ps(v, high));
+        result.count += popcount(_mm_movemask_ps(mask));
+        sums = _mm_add_ps(sums, _mm_and_ps(mask, v));
+        // SSE2 has no blend, so select with and/andnot/or.
+        mins = _mm_min_ps(mins, _mm_or_ps(_mm_and_ps(mask, v),
+                                          _mm_andnot_ps(mask, mins)));
+        maxs = _mm_max_ps(maxs, _mm_or_ps(_mm_and_ps(mask, v),
+                                          _mm_andnot_ps(mask, maxs)));
+      }
+      result.sum += lane_sum(sums);
+    }
+    result.min = lane_min(mins);
+    result.max = lane_max(maxs);
+  }
+#endif
+  for (; i < count; ++i) {
+    auto value = values[i];
+    bool matches = value >= lo && value <= hi;
+    result.count += matches;
+    result.sum += matches ? value : 0;
+    if (matches) {
+      result.min = std::min(result.min, value);
+      result.max = std::max(result.max, value);
+    }
+  }
+  return result;
+}
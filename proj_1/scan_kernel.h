@@ -0,0 +1,25 @@
+#ifndef SCAN_KERNEL_H
+#define SCAN_KERNEL_H
+
+#include <cstddef>
+#include <limits>
+
+// COUNT, SUM, MIN and MAX of the values matching a predicate, from which AVG
+// follows.
+struct RangeAggregate {
+  size_t count = 0;
+  double sum = 0;
+  float min = std::numeric_limits<float>::infinity();
+  float max = -std::numeric_limits<float>::infinity();
+
+  double average() const { return count ? sum / count : 0; };
+  void merge(const RangeAggregate &other);
+};
+
+// Aggregates the values in [lo, hi]. The predicate is evaluated with SIMD
+// compares and applied as a mask to the sums and extrema, so the loop has no
+// data-dependent branches. See simd.h for the instruction sets used.
+RangeAggregate aggregate_range(const float *values, size_t count, float lo,
+                               float hi);
+
+#endif // SCAN_KERNEL_H
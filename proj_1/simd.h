@@ -0,0 +1,34 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// Instruction sets are picked at build time: AVX2 when the compiler targets
+// it (e.g. with -march=native) and SSE2, which every x86-64 CPU has.
+// SIMD_SSE2 is defined whenever SSE2 intrinsics are available.
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define SIMD_SSE2
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+inline int popcount(unsigned int mask) {
+#ifdef _MSC_VER
+  return __popcnt(mask);
+#else
+  return __builtin_popcount(mask);
+#endif
+}
+
+// Name of the instruction set used by the SIMD kernels.
+inline const char *simd_instruction_set() {
+#if defined(__AVX2__)
+  return "AVX2";
+#elif defined(SIMD_SSE2)
+  return "SSE2";
+#else
+  return "scalar";
+#endif
+}
+
+#endif // SIMD_H
@@ -0,0 +1,63 @@
+#include "background_writer.h"
+#include "storage.h"
+#include <stdexcept>
+#include <utility>
+
+BackgroundWriter::BackgroundWriter(Storage *storage,
+                                   BackgroundWriterOptions options)
+    : m_storage(storage), m_options(options) {
+  if (options.blocks_per_round == 0)
+    throw std::invalid_argument("The background writer must write blocks.");
+  // Started last, once every member it uses is initialized.
+  m_thread = std::thread([this] { this->run(); });
+}
+
+BackgroundWriter::~BackgroundWriter() {
+  try {
+    this->stop();
+  } catch (...) {
+  }
+}
+
+void BackgroundWriter::stop() {
+  {
+    std::lock_guard<std::mutex> guard(m_latch);
+    m_stopping = true;
+  }
+  m_stop_requested.notify_all();
+  if (m_thread.joinable())
+    m_thread.join();
+  if (m_error)
+    std::rethrow_exception(std::exchange(m_error, nullptr));
+}
+
+BackgroundWriterStats BackgroundWriter::stats() const {
+  std::lock_guard<std::mutex> guard(m_latch);
+  return m_stats;
+}
+
+void BackgroundWriter::run() {
+  std::unique_lock<std::mutex> lock(m_latch);
+  while (!m_stop_requested.wait_for(lock, m_options.interval,
+                                    [this] { return m_stopping; })) {
+    lock.unlock();
+    size_t written;
+    bool checkpointed = false;
+    try {
+      written = m_storage->write_dirty_blocks(m_options.blocks_per_round);
+      if (m_storage->logging() &&
+          m_storage->log_size() >= m_options.checkpoint_log_bytes) {
+        m_storage->checkpoint();
+        checkpointed = true;
+      }
+    } catch (...) {
+      lock.lock();
+      m_error = std::current_exception();
+      return;
+    }
+    lock.lock();
+    ++m_stats.rounds;
+    m_stats.blocks_written += written;
+    m_stats.checkpoints += checkpointed;
+  }
+}
@@ -0,0 +1,59 @@
+#ifndef BACKGROUND_WRITER_H
+#define BACKGROUND_WRITER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+class Storage;
+
+struct BackgroundWriterOptions {
+  // Time between rounds.
+  std::chrono::milliseconds interval{20};
+  // Most blocks written per round, which caps the writer at blocks_per_round
+  // pages per interval so that it does not compete with foreground I/O.
+  size_t blocks_per_round = 256;
+  // With a log, a checkpoint empties it once it grows past this size.
+  size_t checkpoint_log_bytes = 64 * 1024 * 1024;
+};
+
+struct BackgroundWriterStats {
+  size_t rounds = 0;
+  size_t blocks_written = 0;
+  size_t checkpoints = 0;
+};
+
+// Thread writing the changed blocks of a Storage in place a few at a time, so
+// that they are mostly clean by the time they are evicted or flushed, and
+// flushes only write what changed since the writer last went by. With a log,
+// it also checkpoints once the log is large, which is then cheap.
+class BackgroundWriter {
+public:
+  BackgroundWriter(Storage *storage, BackgroundWriterOptions options);
+  // Stops the thread, dropping any error that stopped it.
+  ~BackgroundWriter();
+
+  BackgroundWriter(const BackgroundWriter &) = delete;
+  BackgroundWriter &operator=(const BackgroundWriter &) = delete;
+
+  // Stops the thread, rethrowing the error that stopped it, if any.
+  void stop();
+  BackgroundWriterStats stats() const;
+
+private:
+  void run();
+
+  Storage *m_storage;
+  BackgroundWriterOptions m_options;
+  mutable std::mutex m_latch;
+  std::condition_variable m_stop_requested;
+  bool m_stopping = false;
+  std::exception_ptr m_error;
+  BackgroundWriterStats m_stats;
+  std::thread m_thread;
+};
+
+#endif // BACKGROUND_WRITER_H
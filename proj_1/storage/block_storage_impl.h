@@ -1,94 +1,440 @@
 #ifndef BLOCK_STORAGE_IMPL_H
 #define BLOCK_STORAGE_IMPL_H
 
+#include "buffer_pool.h"
+#include "paged_file.h"
+#include "read_ahead.h"
+#include "serialize.h"
+#include <algorithm>
 #include <assert.h>
+#include <atomic>
+#include <condition_variable>
 #include <cstdio>
-#include <fstream>
-#include <iostream>
-#include <map>
+#include <istream>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
 
-template <typename T> class BlockStorage {
+// Blocks whose in-memory layout is identical to their page declare
+// `static constexpr bool FIXED_LAYOUT = true`. They are constructed by reading
+// the page directly into their own buffer (T(int block_id, const PagedFile &))
+// and written back from page_data(), skipping (de)serialization entirely.
+template <typename T, typename = void>
+struct has_fixed_layout : std::false_type {};
+template <typename T>
+struct has_fixed_layout<T, std::void_t<decltype(T::FIXED_LAYOUT)>>
+    : std::bool_constant<T::FIXED_LAYOUT> {};
+
+template <typename T> class BlockStorage : public BlockStorageBase {
 public:
-  BlockStorage(const std::string &storage_prefix, int block_count)
-      : m_storage_prefix(storage_prefix), m_total_block_count(block_count) {};
+  BlockStorage(BufferPool *pool, const std::string &storage_file,
+               size_t block_size, int block_count, bool read_only = false)
+      : m_pool(pool), m_file(storage_file, block_size, block_count, read_only),
+        m_page(block_size), m_total_block_count(block_count) {};
   ~BlockStorage() { delete_all_blocks_without_writing(); };
 
-  T *get(int block_id);
+  BlockRef<T> get(int block_id);
+
+  // Starts reading the given blocks ahead of their use, skipping those that
+  // are cached or already being read. A get() for a block being read waits for
+  // that read instead of issuing its own.
+  void prefetch(const std::vector<int> &block_ids, ReadAheadPool &pool);
+  // Reads ahead along a chain of blocks, such as the leaves of a tree: up to
+  // depth blocks starting at block_id, where next(block) gives the id of the
+  // block after it or -1.
+  template <typename Next>
+  void prefetch_chain(int block_id, int depth, Next next, ReadAheadPool &pool);
 
-  int track_new_block(T *value);
+  // Takes over ownership of the block. The returned handle keeps it pinned.
+  BlockRef<T> track_new_block(T *value);
+  void mark_dirty(int block_id);
+  // Blocks changed since their image was last logged are left for after it
+  // is.
   void write_all_cached_blocks();
   void delete_all_blocks_without_writing();
+  // Waits for the file's writes to reach the disk.
+  void sync() { this->m_file.sync(); };
+
+  void copy_page(int block_id, char *page) const override;
+  void write_page(int block_id, const char *page) override;
+  // Writes a page recovered from the log straight to the file, growing it if
+  // needed. The block must not be cached.
+  void restore_page(int block_id, const char *page);
+
+  // Memory maps the (read-only) storage file, after which get_mapped returns
+  // the serialized contents of a block (or the whole page for fixed layout
+  // blocks) in place without using the pool.
+  void map();
+  bool is_mapped() const { return this->m_file.is_mapped(); };
+  std::string_view get_mapped(int block_id);
 
-  int loaded_block_count() const { return this->m_cached_entries.size(); };
+  int block_count() const { return this->m_total_block_count; };
+  const CacheStats &stats() const { return this->m_stats; };
+  void reset_stats() {
+    std::lock_guard<std::mutex> guard(this->m_pool->latch());
+    this->m_stats = {};
+    std::fill(this->m_touched.begin(), this->m_touched.end(), false);
+  };
+
+protected:
+  void evict(Frame &frame) override;
 
 private:
-  const std::string block_location(int block_id) const;
-  void read_block(int block_id);
+  struct CachedBlock {
+    T *value;
+    Frame *frame;
+    // Read ahead and not used since. Its first get() counts as the miss.
+    bool prefetched;
+  };
+
+  // Reads and decodes a block. Does not need the latch.
+  T *read_block(int block_id) const;
+  // Reserves the entry of a block being read. Expects the latch to be held.
+  void start_loading(int block_id);
+  // Reads a block reserved by start_loading in the background and calls then()
+  // once it is cached.
+  template <typename Then>
+  void load_ahead(int block_id, ReadAheadPool &pool, Then then);
+  // Reads a block reserved by start_loading and caches it. A failed read is
+  // dropped, leaving it to a later get() to report the error. Returns whether
+  // the block was cached.
+  bool finish_loading(int block_id);
+  // Lays a block out as it is written to its page.
+  void encode_page(const T *block, char *page) const;
+  void write_block(const T *block);
 
-  std::map<int, T *> m_cached_entries;
-  const std::string m_storage_prefix;
-  int m_total_block_count;
+  // Blocks being read by a thread have an entry with a null value until the
+  // read completes, which m_loaded signals.
+  std::unordered_map<int, CachedBlock> m_cached_entries;
+  std::condition_variable m_loaded;
+  int m_loading_count = 0;
+  BufferPool *m_pool;
+  PagedFile m_file;
+  std::vector<char> m_page;
+  std::atomic<int> m_total_block_count;
+  CacheStats m_stats;
+  // Blocks accessed through the mapping since the last reset, so that the
+  // first access to each counts as a miss like it would through the pool.
+  std::vector<bool> m_touched;
 };
 
-template <typename T> T *BlockStorage<T>::get(int block_id) {
+template <typename T> BlockRef<T> BlockStorage<T>::get(int block_id) {
+  std::unique_lock<std::mutex> lock(this->m_pool->latch());
   auto it = this->m_cached_entries.find(block_id);
-  if (it != this->m_cached_entries.end())
-    return it->second;
-  this->read_block(block_id);
-  // It should be cached now.
-  it = this->m_cached_entries.find(block_id);
-  assert(it != this->m_cached_entries.end());
-  return it->second;
+  // Wait while another thread is reading the block.
+  while (it != this->m_cached_entries.end() && !it->second.value) {
+    this->m_loaded.wait(lock);
+    it = this->m_cached_entries.find(block_id);
+  }
+  if (it != this->m_cached_entries.end()) {
+    if (it->second.prefetched) {
+      ++this->m_stats.misses;
+      it->second.prefetched = false;
+    } else {
+      ++this->m_stats.hits;
+    }
+    return BlockRef<T>(it->second.value, it->second.frame);
+  }
+  ++this->m_stats.misses;
+
+  // Reserve the entry and read the page without holding the latch, so that
+  // threads missing on different blocks read them concurrently.
+  this->start_loading(block_id);
+  lock.unlock();
+  T *block = nullptr;
+  Frame *frame = nullptr;
+  try {
+    block = this->read_block(block_id);
+    lock.lock();
+    frame = this->m_pool->allocate(this, block_id);
+  } catch (...) {
+    if (!lock.owns_lock())
+      lock.lock();
+    delete block;
+    this->m_cached_entries.erase(block_id);
+    --this->m_loading_count;
+    this->m_loaded.notify_all();
+    throw;
+  }
+  this->m_cached_entries[block_id] = CachedBlock{block, frame, false};
+  --this->m_loading_count;
+  this->m_loaded.notify_all();
+  return BlockRef<T>(block, frame);
 }
 
-template <typename T> void BlockStorage<T>::read_block(int block_id) {
-  assert(this->m_cached_entries.find(block_id) == this->m_cached_entries.end());
-  assert(block_id >= 0);
-  std::ifstream file(block_location(block_id), std::ios::binary);
-  if (!file)
-    throw std::runtime_error("Error opening file for reading.");
+template <typename T> T *BlockStorage<T>::read_block(int block_id) const {
+  assert(block_id >= 0 && block_id < this->m_total_block_count);
+  if constexpr (has_fixed_layout<T>::value) {
+    return new T(block_id, this->m_file);
+  } else {
+    std::vector<char> page(this->m_file.page_size());
+    this->m_file.read_page(block_id, page.data());
 
-  auto block = new T(block_id, file);
-  file.close();
+    auto length = Serializer::load_uint32(page.data());
+    if (length > page.size() - PAGE_HEADER_SIZE)
+      throw std::runtime_error("Corrupted page header.");
+
+    MemoryStreamBuf payload(page.data() + PAGE_HEADER_SIZE, length);
+    std::istream stream(&payload);
+    return new T(block_id, stream);
+  }
+}
 
-  this->m_cached_entries.insert_or_assign(block_id, block);
+template <typename T> void BlockStorage<T>::start_loading(int block_id) {
+  this->m_cached_entries.insert({block_id, CachedBlock{nullptr, nullptr}});
+  ++this->m_loading_count;
 }
 
-template <typename T> int BlockStorage<T>::track_new_block(T *value) {
+template <typename T>
+void BlockStorage<T>::prefetch(const std::vector<int> &block_ids,
+                               ReadAheadPool &pool) {
+  // The OS already reads ahead of page faults on a mapping.
+  if (this->is_mapped())
+    return;
+  std::vector<int> reserved;
+  {
+    std::lock_guard<std::mutex> guard(this->m_pool->latch());
+    for (auto block_id : block_ids) {
+      if (block_id < 0 || block_id >= this->m_total_block_count ||
+          this->m_cached_entries.count(block_id))
+        continue;
+      this->start_loading(block_id);
+      reserved.push_back(block_id);
+    }
+  }
+  for (auto block_id : reserved)
+    this->load_ahead(block_id, pool, [] {});
+}
+
+template <typename T>
+template <typename Next>
+void BlockStorage<T>::prefetch_chain(int block_id, int depth, Next next,
+                                     ReadAheadPool &pool) {
+  {
+    std::lock_guard<std::mutex> guard(this->m_pool->latch());
+    bool reserved = false;
+    for (; block_id >= 0 && depth > 0; --depth) {
+      assert(block_id < this->m_total_block_count);
+      auto it = this->m_cached_entries.find(block_id);
+      if (it == this->m_cached_entries.end()) {
+        this->start_loading(block_id);
+        reserved = true;
+        break;
+      }
+      // Whoever is reading the block continues from there.
+      if (!it->second.value)
+        return;
+      block_id = next(*it->second.value);
+    }
+    if (!reserved)
+      return;
+  }
+  // The rest of the chain is only known once this block is read.
+  this->load_ahead(block_id, pool, [this, block_id, depth, next, &pool] {
+    this->prefetch_chain(block_id, depth, next, pool);
+  });
+}
+
+template <typename T>
+template <typename Then>
+void BlockStorage<T>::load_ahead(int block_id, ReadAheadPool &pool,
+                                 Then then) {
+  // A page in the OS cache is read right away, which costs no more than the
+  // later get() would, rather than waking a read-ahead thread for it.
+  if (this->m_file.is_page_cached(block_id)) {
+    if (this->finish_loading(block_id))
+      then();
+    return;
+  }
+  pool.submit([this, block_id, then] {
+    if (this->finish_loading(block_id))
+      then();
+  });
+}
+
+template <typename T> bool BlockStorage<T>::finish_loading(int block_id) {
+  T *block = nullptr;
+  try {
+    block = this->read_block(block_id);
+  } catch (...) {
+  }
+  std::lock_guard<std::mutex> guard(this->m_pool->latch());
+  Frame *frame = nullptr;
+  try {
+    if (block)
+      frame = this->m_pool->allocate(this, block_id);
+  } catch (...) {
+  }
+  --this->m_loading_count;
+  this->m_loaded.notify_all();
+  if (!frame) {
+    delete block;
+    this->m_cached_entries.erase(block_id);
+    return false;
+  }
+  this->m_cached_entries[block_id] = CachedBlock{block, frame, true};
+  ++this->m_stats.prefetches;
+  return true;
+}
+
+template <typename T> BlockRef<T> BlockStorage<T>::track_new_block(T *value) {
+  std::lock_guard<std::mutex> guard(this->m_pool->latch());
+  if (this->m_file.is_read_only())
+    throw std::runtime_error("Cannot add blocks to a read-only storage.");
   value->id = this->m_total_block_count;
-  this->m_cached_entries.insert_or_assign(this->m_total_block_count, value);
   ++this->m_total_block_count;
-  return this->m_total_block_count - 1;
+  this->m_file.reserve(this->m_total_block_count);
+
+  auto frame = this->m_pool->allocate(this, value->id);
+  this->m_pool->mark_dirty_latched(*frame);
+  this->m_cached_entries.insert_or_assign(value->id,
+                                          CachedBlock{value, frame, false});
+  return BlockRef<T>(value, frame);
+}
+
+template <typename T> void BlockStorage<T>::mark_dirty(int block_id) {
+  std::lock_guard<std::mutex> guard(this->m_pool->latch());
+  auto it = this->m_cached_entries.find(block_id);
+  assert(it != this->m_cached_entries.end());
+  this->m_pool->mark_dirty_latched(*it->second.frame);
+}
+
+template <typename T> void BlockStorage<T>::map() {
+  this->m_file.map();
+  this->m_touched.assign(this->m_total_block_count, false);
+}
+
+template <typename T>
+std::string_view BlockStorage<T>::get_mapped(int block_id) {
+  std::lock_guard<std::mutex> guard(this->m_pool->latch());
+  assert(this->is_mapped());
+  assert(block_id >= 0 && block_id < this->m_total_block_count);
+  if (this->m_touched[block_id]) {
+    ++this->m_stats.hits;
+  } else {
+    ++this->m_stats.misses;
+    this->m_touched[block_id] = true;
+  }
+  auto page = this->m_file.mapped_page(block_id);
+  if constexpr (has_fixed_layout<T>::value)
+    return std::string_view(page, this->m_file.page_size());
+  auto length = Serializer::load_uint32(page);
+  if (length > this->m_file.page_size() - PAGE_HEADER_SIZE)
+    throw std::runtime_error("Corrupted page header.");
+  return std::string_view(page + PAGE_HEADER_SIZE, length);
 }
 
 template <typename T> void BlockStorage<T>::write_all_cached_blocks() {
+  std::lock_guard<std::mutex> guard(this->m_pool->latch());
+  // Write in block order so that the file is written sequentially.
+  std::vector<CachedBlock> dirty_blocks;
   for (auto it = this->m_cached_entries.begin();
        it != this->m_cached_entries.end(); ++it) {
-    auto block = it->second;
+    if (!it->second.value)
+      continue;
     assert(it->first >= 0);
-    assert(block->id == it->first);
-    std::ofstream file(block_location(block->id), std::ios::binary);
-    if (!file) {
-      std::cerr << "Error opening file for writing." << std::endl;
-      return;
-    }
-    block->serialize(file);
-    file.close();
+    assert(it->second.value->id == it->first);
+    if (it->second.frame->dirty && !it->second.frame->unlogged)
+      dirty_blocks.push_back(it->second);
+  }
+  std::sort(dirty_blocks.begin(), dirty_blocks.end(),
+            [](const CachedBlock &a, const CachedBlock &b) {
+              return a.value->id < b.value->id;
+            });
+  for (const auto &cached : dirty_blocks) {
+    this->m_pool->wait_until_logged(*cached.frame);
+    this->write_block(cached.value);
+    cached.frame->dirty = false;
   }
 }
 
 template <typename T>
-void BlockStorage<T>::delete_all_blocks_without_writing() {
-  for (auto it = this->m_cached_entries.begin();
-       it != this->m_cached_entries.end(); ++it)
-    delete it->second;
-  this->m_cached_entries.clear();
+void BlockStorage<T>::encode_page(const T *block, char *page) const {
+  auto page_size = this->m_file.page_size();
+  if constexpr (has_fixed_layout<T>::value) {
+    assert(block->page_size() == page_size);
+    std::copy(block->page_data(), block->page_data() + page_size, page);
+  } else {
+    std::fill(page, page + page_size, 0);
+    MemoryStreamBuf payload(page + PAGE_HEADER_SIZE,
+                            page_size - PAGE_HEADER_SIZE);
+    std::ostream stream(&payload);
+    block->serialize(stream);
+    if (stream.fail())
+      throw std::runtime_error("Block " + std::to_string(block->id) +
+                               " does not fit in a page.");
+
+    MemoryStreamBuf header(page, PAGE_HEADER_SIZE);
+    std::ostream header_stream(&header);
+    Serializer::write_uint32(header_stream, payload.written());
+  }
+}
+
+template <typename T> void BlockStorage<T>::write_block(const T *block) {
+  ++this->m_stats.writes;
+  if constexpr (has_fixed_layout<T>::value) {
+    assert(block->page_size() == this->m_file.page_size());
+    this->m_file.write_page(block->id, block->page_data());
+  } else {
+    this->encode_page(block, this->m_page.data());
+    this->m_file.write_page(block->id, this->m_page.data());
+  }
 }
 
 template <typename T>
-const std::string BlockStorage<T>::block_location(int block_id) const {
-  return this->m_storage_prefix + std::to_string(block_id) + ".dat";
+void BlockStorage<T>::copy_page(int block_id, char *page) const {
+  auto it = this->m_cached_entries.find(block_id);
+  assert(it != this->m_cached_entries.end() && it->second.value);
+  this->encode_page(it->second.value, page);
+}
+
+template <typename T>
+void BlockStorage<T>::write_page(int block_id, const char *page) {
+  this->m_file.write_page(block_id, page);
+  std::lock_guard<std::mutex> guard(this->m_pool->latch());
+  ++this->m_stats.writes;
+}
+
+template <typename T>
+void BlockStorage<T>::restore_page(int block_id, const char *page) {
+  std::lock_guard<std::mutex> guard(this->m_pool->latch());
+  assert(!this->m_cached_entries.count(block_id));
+  if (block_id >= this->m_total_block_count) {
+    this->m_total_block_count = block_id + 1;
+    this->m_file.reserve(this->m_total_block_count);
+  }
+  this->m_file.write_page(block_id, page);
+}
+
+template <typename T> void BlockStorage<T>::evict(Frame &frame) {
+  auto it = this->m_cached_entries.find(frame.block_id);
+  assert(it != this->m_cached_entries.end());
+  assert(it->second.frame == &frame);
+  if (frame.dirty) {
+    this->m_pool->wait_until_logged(frame);
+    this->write_block(it->second.value);
+  }
+  delete it->second.value;
+  this->m_cached_entries.erase(it);
+  ++this->m_stats.evictions;
+}
+
+template <typename T>
+void BlockStorage<T>::delete_all_blocks_without_writing() {
+  std::unique_lock<std::mutex> lock(this->m_pool->latch());
+  // Let reads in progress, such as read-ahead, finish first.
+  this->m_loaded.wait(lock, [this] { return this->m_loading_count == 0; });
+  for (auto it = this->m_cached_entries.begin();
+       it != this->m_cached_entries.end(); ++it) {
+    delete it->second.value;
+    this->m_pool->release(it->second.frame);
+  }
+  this->m_cached_entries.clear();
 }
 
 #endif // BLOCK_STORAGE_IMPL_H
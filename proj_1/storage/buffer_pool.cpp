@@ -0,0 +1,127 @@
+#include "buffer_pool.h"
+#include "wal.h"
+#include <algorithm>
+#include <assert.h>
+#include <stdexcept>
+
+// Keep enough frames for a root-to-leaf path plus the blocks an insert touches.
+constexpr size_t MIN_FRAME_COUNT = 64;
+
+BufferPool::BufferPool(size_t byte_budget, size_t block_size) {
+  auto frame_count = byte_budget / block_size;
+  if (frame_count < MIN_FRAME_COUNT)
+    frame_count = MIN_FRAME_COUNT;
+  m_frames = std::make_unique<Frame[]>(frame_count);
+  m_frame_count = frame_count;
+  m_free.reserve(frame_count);
+  for (auto i = frame_count; i > 0; --i)
+    m_free.push_back(i - 1);
+}
+
+Frame *BufferPool::allocate(BlockStorageBase *owner, int block_id) {
+  Frame *frame;
+  if (!m_free.empty()) {
+    frame = &m_frames[m_free.back()];
+    m_free.pop_back();
+  } else {
+    frame = this->find_victim();
+    frame->owner->evict(*frame);
+  }
+  frame->pool = this;
+  frame->owner = owner;
+  frame->block_id = block_id;
+  frame->dirty = false;
+  frame->referenced = true;
+  frame->lsn = 0;
+  return frame;
+}
+
+void BufferPool::release(Frame *frame) {
+  assert(frame->pin_count == 0);
+  if (frame->unlogged) {
+    // Its changes are dropped along with it.
+    m_unlogged.erase(std::find(m_unlogged.begin(), m_unlogged.end(), frame));
+    --m_unlogged_count;
+    frame->unlogged = false;
+  }
+  frame->owner = nullptr;
+  frame->block_id = -1;
+  frame->dirty = false;
+  frame->referenced = false;
+  m_free.push_back(frame - m_frames.get());
+}
+
+Frame *BufferPool::find_victim() {
+  // Evicting a block whose image is not yet durable would sync the log while
+  // holding the latch, so such blocks are only taken when nothing else is.
+  auto durable_lsn = m_log ? m_log->durable_lsn() : 0;
+  Frame *not_durable = nullptr;
+  // Two sweeps are enough to clear every reference bit once.
+  for (size_t i = 0; i < 2 * m_frame_count; ++i) {
+    Frame &frame = m_frames[m_clock_hand];
+    m_clock_hand = (m_clock_hand + 1) % m_frame_count;
+    if (frame.pin_count > 0 || frame.unlogged)
+      continue;
+    if (frame.referenced) {
+      frame.referenced = false;
+      continue;
+    }
+    if (frame.dirty && frame.lsn > durable_lsn) {
+      if (!not_durable)
+        not_durable = &frame;
+      continue;
+    }
+    return &frame;
+  }
+  if (not_durable)
+    return not_durable;
+  throw std::runtime_error(
+      m_unlogged_count ? "Buffer pool exhausted: every block is pinned or "
+                         "waiting to be logged."
+                       : "Buffer pool exhausted: every block is pinned.");
+}
+
+void BufferPool::mark_dirty(Frame &frame) {
+  frame.dirty = true;
+  if (!m_log || frame.unlogged)
+    return;
+  std::lock_guard<std::mutex> guard(m_latch);
+  this->mark_dirty_latched(frame);
+}
+
+void BufferPool::mark_dirty_latched(Frame &frame) {
+  frame.dirty = true;
+  if (!m_log || frame.unlogged.exchange(true))
+    return;
+  m_unlogged.push_back(&frame);
+  ++m_unlogged_count;
+}
+
+std::vector<Frame *> BufferPool::take_unlogged() {
+  std::vector<Frame *> frames;
+  std::swap(frames, m_unlogged);
+  m_unlogged_count = 0;
+  for (auto frame : frames)
+    frame->unlogged = false;
+  return frames;
+}
+
+void BufferPool::wait_until_logged(const Frame &frame) {
+  assert(!frame.unlogged);
+  if (m_log && frame.lsn > 0)
+    m_log->flush(frame.lsn);
+}
+
+std::vector<Frame *> BufferPool::take_dirty(size_t max_count) {
+  std::vector<Frame *> frames;
+  for (size_t i = 0; i < m_frame_count && frames.size() < max_count; ++i) {
+    Frame &frame = m_frames[m_writer_hand];
+    m_writer_hand = (m_writer_hand + 1) % m_frame_count;
+    if (!frame.owner || !frame.dirty || frame.unlogged)
+      continue;
+    frame.dirty = false;
+    ++frame.pin_count;
+    frames.push_back(&frame);
+  }
+  return frames;
+}
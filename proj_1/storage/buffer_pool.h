@@ -0,0 +1,167 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// 256 MiB worth of blocks are kept in memory unless configured otherwise.
+constexpr size_t DEFAULT_BUFFER_POOL_BYTES = 256 * 1024 * 1024;
+
+struct CacheStats {
+  size_t hits = 0;
+  size_t misses = 0;
+  size_t evictions = 0;
+  // Blocks read by read-ahead rather than on a miss.
+  size_t prefetches = 0;
+  // Blocks written back to the file, whether evicted, flushed or written by
+  // the background writer.
+  size_t writes = 0;
+};
+
+class BlockStorageBase;
+class BufferPool;
+class WriteAheadLog;
+
+// Book-keeping for one block resident in memory. Blocks with a non-zero pin
+// count are never evicted. Handles pin and unpin without holding the pool
+// latch, so the flags are atomic.
+struct Frame {
+  BufferPool *pool = nullptr;
+  BlockStorageBase *owner = nullptr;
+  int block_id = -1;
+  std::atomic<int> pin_count{0};
+  std::atomic<bool> dirty{false};
+  std::atomic<bool> referenced{false};
+  // With a log, changed since its image was last logged, in which case it is
+  // never written in place. Such blocks are not evicted.
+  std::atomic<bool> unlogged{false};
+  // Log batch holding the last image of the block, which must be durable
+  // before the block is written in place.
+  std::atomic<uint64_t> lsn{0};
+};
+
+class BlockStorageBase {
+public:
+  virtual ~BlockStorageBase() = default;
+
+  // Copies the page a cached block would be written as. Expects the pool
+  // latch to be held.
+  virtual void copy_page(int block_id, char *page) const = 0;
+  // Writes a page copied by copy_page in place, without the pool latch. The
+  // frame of the block must stay pinned meanwhile.
+  virtual void write_page(int block_id, const char *page) = 0;
+
+protected:
+  friend class BufferPool;
+  // Writes the block back if it is dirty and drops it from memory.
+  virtual void evict(Frame &frame) = 0;
+};
+
+// Fixed number of frames shared between every BlockStorage of a Storage.
+// When all frames are in use, an unpinned block is evicted using the CLOCK
+// (second chance) policy.
+//
+// The pool and every BlockStorage using it are guarded by a single latch.
+// BlockStorage takes it in its public methods; allocate and release expect the
+// caller to hold it.
+class BufferPool {
+public:
+  BufferPool(size_t byte_budget, size_t block_size);
+
+  BufferPool(const BufferPool &) = delete;
+  BufferPool &operator=(const BufferPool &) = delete;
+
+  // Returns a frame for the given block, evicting another block if needed.
+  Frame *allocate(BlockStorageBase *owner, int block_id);
+  void release(Frame *frame);
+
+  // With a log, changed blocks are tracked until their image is logged, and
+  // logged images are made durable before blocks are written in place.
+  void set_log(WriteAheadLog *log) { m_log = log; };
+  bool logging() const { return m_log != nullptr; };
+  // Marks the block of a frame as changed. Takes the latch when logging.
+  void mark_dirty(Frame &frame);
+  // The same, expecting the latch to be held.
+  void mark_dirty_latched(Frame &frame);
+  // Frames changed since the last call, whose images are about to be
+  // logged. Expects the latch to be held.
+  std::vector<Frame *> take_unlogged();
+  size_t unlogged_count() const { return m_unlogged_count; };
+  // Makes the logged image of a block durable before it is written in place.
+  void wait_until_logged(const Frame &frame);
+  // Up to max_count frames of changed blocks whose image is logged (if
+  // logging), taken in turn across calls so that every block gets written.
+  // They are marked clean and pinned, for the caller to write their pages
+  // outside the latch and then unpin them. Expects the latch to be held.
+  std::vector<Frame *> take_dirty(size_t max_count);
+
+  size_t frame_count() const { return m_frame_count; };
+  size_t used_frame_count() const { return m_frame_count - m_free.size(); };
+
+  std::mutex &latch() { return m_latch; };
+
+private:
+  Frame *find_victim();
+
+  std::mutex m_latch;
+  std::unique_ptr<Frame[]> m_frames;
+  size_t m_frame_count;
+  std::vector<size_t> m_free;
+  size_t m_clock_hand = 0;
+  size_t m_writer_hand = 0;
+  WriteAheadLog *m_log = nullptr;
+  std::vector<Frame *> m_unlogged;
+  std::atomic<size_t> m_unlogged_count{0};
+};
+
+// Handle to a block pinned in the buffer pool. The block stays in memory for
+// as long as at least one handle to it exists.
+template <typename T> class BlockRef {
+public:
+  BlockRef() {};
+  BlockRef(T *value, Frame *frame) : m_value(value), m_frame(frame) {
+    this->pin();
+  };
+  BlockRef(const BlockRef &other) : BlockRef(other.m_value, other.m_frame) {};
+  BlockRef(BlockRef &&other) : m_value(other.m_value), m_frame(other.m_frame) {
+    other.m_value = nullptr;
+    other.m_frame = nullptr;
+  };
+  ~BlockRef() { this->unpin(); };
+
+  BlockRef &operator=(BlockRef other) {
+    std::swap(this->m_value, other.m_value);
+    std::swap(this->m_frame, other.m_frame);
+    return *this;
+  };
+
+  T *get() const { return m_value; };
+  T *operator->() const { return m_value; };
+  T &operator*() const { return *m_value; };
+  explicit operator bool() const { return m_value != nullptr; };
+
+  void mark_dirty() const { m_frame->pool->mark_dirty(*m_frame); };
+
+private:
+  void pin() {
+    if (!m_frame)
+      return;
+    ++m_frame->pin_count;
+    m_frame->referenced = true;
+  };
+  void unpin() {
+    if (!m_frame)
+      return;
+    --m_frame->pin_count;
+  };
+
+  T *m_value = nullptr;
+  Frame *m_frame = nullptr;
+};
+
+#endif // BUFFER_POOL_H
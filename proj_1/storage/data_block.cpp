@@ -1,6 +1,7 @@
 #include "data_block.h"
 #include "serialize.h"
 #include <assert.h>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <istream>
@@ -52,6 +53,240 @@ int DataBlock::serialize(std::ostream &stream) const {
   return size;
 }
 
+DataBlockView::DataBlockView(BlockRef<DataBlock> block)
+    : m_id(block->id), m_size(block->records.size()), m_block(block),
+      m_records(block->records.data()) {}
+
+DataBlockView::DataBlockView(BlockRef<ColumnarDataBlock> block)
+    : m_id(block->id), m_size(block->size()), m_columnar_block(block) {
+  auto page = block->page_data();
+  m_columns = page;
+  m_capacity = reinterpret_cast<const ColumnarHeader *>(page)->capacity;
+}
+
+DataBlockView::DataBlockView(int id, const char *bytes, size_t length)
+    : m_id(id), m_size(length / Record::SERIALIZED_SIZE), m_bytes(bytes) {}
+
+DataBlockView DataBlockView::from_columnar_page(int id, const char *page) {
+  DataBlockView view;
+  const ColumnarHeader *header = reinterpret_cast<const ColumnarHeader *>(page);
+  view.m_id = id;
+  view.m_size = header->record_count;
+  view.m_columns = page;
+  view.m_capacity = header->capacity;
+  return view;
+}
+
+ColumnarDataBlock::ColumnarDataBlock(size_t page_size)
+    : m_page(new char[page_size]{}), m_page_size(page_size) {
+  this->header()->capacity = max_records(page_size);
+}
+
+ColumnarDataBlock::ColumnarDataBlock(int block_id, const PagedFile &file)
+    : id(block_id), m_page(new char[file.page_size()]),
+      m_page_size(file.page_size()) {
+  file.read_page(block_id, this->m_page);
+  auto header = this->header();
+  if (header->capacity != (uint32_t)max_records(m_page_size) ||
+      header->record_count > header->capacity) {
+    delete[] this->m_page;
+    throw std::runtime_error("Corrupted columnar data block " +
+                             std::to_string(block_id) + ".");
+  }
+}
+
+ColumnarDataBlock::~ColumnarDataBlock() { delete[] this->m_page; }
+
+int ColumnarDataBlock::max_records(size_t page_size) {
+  return (page_size - sizeof(ColumnarHeader)) / Record::SERIALIZED_SIZE;
+}
+
+bool ColumnarDataBlock::full() const {
+  return this->header()->record_count == this->header()->capacity;
+}
+
+// Stores value at index i of the column.
+template <typename T>
+static void store_column(char *page, Column column, size_t i, T value) {
+  auto capacity = reinterpret_cast<ColumnarHeader *>(page)->capacity;
+  auto start = page + sizeof(ColumnarHeader) + capacity * (size_t)column;
+  std::memcpy(start + i * sizeof(T), &value, sizeof(T));
+}
+
+void ColumnarDataBlock::push_back(const Record &record) {
+  assert(!this->full());
+  auto i = this->header()->record_count;
+  store_column(m_page, Column::GameDateEst, i, record.game_date_est);
+  store_column(m_page, Column::TeamIdHome, i, record.team_id_home);
+  store_column(m_page, Column::FgPctHome, i, record.fg_pct_home);
+  store_column(m_page, Column::FtPctHome, i, record.ft_pct_home);
+  store_column(m_page, Column::Fg3PctHome, i, record.fg3_pct_home);
+  store_column(m_page, Column::AstHome, i, record.ast_home);
+  store_column(m_page, Column::RebHome, i, record.reb_home);
+  store_column(m_page, Column::PtsHome, i, record.pts_home);
+  store_column(m_page, Column::HomeTeamWins, i, record.home_team_wins);
+  ++this->header()->record_count;
+}
+
+const char *DataBlockView::column_start(Column column) const {
+  return m_columns + sizeof(ColumnarHeader) + m_capacity * (size_t)column;
+}
+
+template <typename T>
+T DataBlockView::column_value(Column column, size_t i) const {
+  T value;
+  std::memcpy(&value, this->column_start(column) + i * sizeof(T), sizeof(T));
+  return value;
+}
+
+uint32_t DataBlockView::game_date_est(size_t i) const {
+  assert(i < m_size);
+  if (m_records)
+    return m_records[i].game_date_est;
+  if (m_columns)
+    return column_value<uint32_t>(Column::GameDateEst, i);
+  return Serializer::load_uint32(field(i, Column::GameDateEst));
+}
+
+uint32_t DataBlockView::team_id_home(size_t i) const {
+  assert(i < m_size);
+  if (m_records)
+    return m_records[i].team_id_home;
+  if (m_columns)
+    return column_value<uint32_t>(Column::TeamIdHome, i);
+  return Serializer::load_uint32(field(i, Column::TeamIdHome));
+}
+
+float DataBlockView::fg_pct_home(size_t i) const {
+  assert(i < m_size);
+  if (m_records)
+    return m_records[i].fg_pct_home;
+  if (m_columns)
+    return column_value<float>(Column::FgPctHome, i);
+  return Serializer::load_float(field(i, Column::FgPctHome));
+}
+
+float DataBlockView::ft_pct_home(size_t i) const {
+  assert(i < m_size);
+  if (m_records)
+    return m_records[i].ft_pct_home;
+  if (m_columns)
+    return column_value<float>(Column::FtPctHome, i);
+  return Serializer::load_float(field(i, Column::FtPctHome));
+}
+
+float DataBlockView::fg3_pct_home(size_t i) const {
+  assert(i < m_size);
+  if (m_records)
+    return m_records[i].fg3_pct_home;
+  if (m_columns)
+    return column_value<float>(Column::Fg3PctHome, i);
+  return Serializer::load_float(field(i, Column::Fg3PctHome));
+}
+
+uint16_t DataBlockView::ast_home(size_t i) const {
+  assert(i < m_size);
+  if (m_records)
+    return m_records[i].ast_home;
+  if (m_columns)
+    return column_value<uint16_t>(Column::AstHome, i);
+  return Serializer::load_uint16(field(i, Column::AstHome));
+}
+
+uint16_t DataBlockView::reb_home(size_t i) const {
+  assert(i < m_size);
+  if (m_records)
+    return m_records[i].reb_home;
+  if (m_columns)
+    return column_value<uint16_t>(Column::RebHome, i);
+  return Serializer::load_uint16(field(i, Column::RebHome));
+}
+
+uint16_t DataBlockView::pts_home(size_t i) const {
+  assert(i < m_size);
+  if (m_records)
+    return m_records[i].pts_home;
+  if (m_columns)
+    return column_value<uint16_t>(Column::PtsHome, i);
+  return Serializer::load_uint16(field(i, Column::PtsHome));
+}
+
+bool DataBlockView::home_team_wins(size_t i) const {
+  assert(i < m_size);
+  if (m_records)
+    return m_records[i].home_team_wins;
+  if (m_columns)
+    return column_value<bool>(Column::HomeTeamWins, i);
+  return *field(i, Column::HomeTeamWins) != 0;
+}
+
+// Decodes a big-endian value of a serialized record.
+template <typename T> static T load_value(const char *bytes) {
+  if constexpr (std::is_same_v<T, uint32_t>)
+    return Serializer::load_uint32(bytes);
+  else if constexpr (std::is_same_v<T, float>)
+    return Serializer::load_float(bytes);
+  else if constexpr (std::is_same_v<T, uint16_t>)
+    return Serializer::load_uint16(bytes);
+  else
+    return *bytes != 0;
+}
+
+template <typename T>
+void DataBlockView::decode_column(Column column, T *values) const {
+  assert(!m_columns);
+  if (m_bytes) {
+    for (size_t i = 0; i < m_size; ++i)
+      values[i] = load_value<T>(this->field(i, column));
+    return;
+  }
+  auto copy = [&](auto field) {
+    for (size_t i = 0; i < m_size; ++i)
+      values[i] = m_records[i].*field;
+  };
+  switch (column) {
+  case Column::GameDateEst:
+    return copy(&Record::game_date_est);
+  case Column::TeamIdHome:
+    return copy(&Record::team_id_home);
+  case Column::FgPctHome:
+    return copy(&Record::fg_pct_home);
+  case Column::FtPctHome:
+    return copy(&Record::ft_pct_home);
+  case Column::Fg3PctHome:
+    return copy(&Record::fg3_pct_home);
+  case Column::AstHome:
+    return copy(&Record::ast_home);
+  case Column::RebHome:
+    return copy(&Record::reb_home);
+  case Column::PtsHome:
+    return copy(&Record::pts_home);
+  case Column::HomeTeamWins:
+    return copy(&Record::home_team_wins);
+  }
+}
+
+template void DataBlockView::decode_column(Column, uint32_t *) const;
+template void DataBlockView::decode_column(Column, float *) const;
+template void DataBlockView::decode_column(Column, uint16_t *) const;
+template void DataBlockView::decode_column(Column, uint8_t *) const;
+
+Record DataBlockView::record(size_t i) const {
+  if (m_records)
+    return m_records[i];
+  return Record{
+      .game_date_est = this->game_date_est(i),
+      .team_id_home = this->team_id_home(i),
+      .fg_pct_home = this->fg_pct_home(i),
+      .ft_pct_home = this->ft_pct_home(i),
+      .fg3_pct_home = this->fg3_pct_home(i),
+      .ast_home = this->ast_home(i),
+      .reb_home = this->reb_home(i),
+      .pts_home = this->pts_home(i),
+      .home_team_wins = this->home_team_wins(i),
+  };
+}
+
 std::vector<Record> read_records_from_file(const std::string &filename) {
   std::vector<Record> records;
   std::ifstream file(filename);
@@ -1,8 +1,12 @@
 #ifndef DATA_BLOCK_H
 #define DATA_BLOCK_H
 
+#include "buffer_pool.h"
+#include "paged_file.h"
 #include <cstdint>
 #include <ostream>
+#include <stdexcept>
+#include <type_traits>
 #include <vector>
 
 struct Record {
@@ -18,8 +22,40 @@ struct Record {
 
   static int size_unpadded(); // 27 bytes
   static int size();          // 28 bytes (actual size w/ padding)
+  // Fields are serialized big-endian, without padding, in declaration order.
+  static constexpr int SERIALIZED_SIZE = 27;
 };
 
+// Columns of a record. Each value is the byte offset of the field inside a
+// serialized record, which is also the combined width of the columns before
+// it.
+enum class Column : size_t {
+  GameDateEst = 0,
+  TeamIdHome = 4,
+  FgPctHome = 8,
+  FtPctHome = 12,
+  Fg3PctHome = 16,
+  AstHome = 20,
+  RebHome = 22,
+  PtsHome = 24,
+  HomeTeamWins = 26,
+};
+// Whether T is the type of the column's values. home_team_wins is read as
+// uint8_t, as std::vector<bool> cannot hold it contiguously.
+template <typename T> constexpr bool column_holds(Column column) {
+  if constexpr (std::is_same_v<T, uint32_t>)
+    return column == Column::GameDateEst || column == Column::TeamIdHome;
+  else if constexpr (std::is_same_v<T, float>)
+    return column == Column::FgPctHome || column == Column::FtPctHome ||
+           column == Column::Fg3PctHome;
+  else if constexpr (std::is_same_v<T, uint16_t>)
+    return column == Column::AstHome || column == Column::RebHome ||
+           column == Column::PtsHome;
+  else if constexpr (std::is_same_v<T, uint8_t>)
+    return column == Column::HomeTeamWins;
+  return false;
+}
+
 struct DataBlock {
   int id = -1;
   std::vector<Record> records{};
@@ -30,6 +66,129 @@ struct DataBlock {
   int serialize(std::ostream &stream) const;
 };
 
+struct ColumnarHeader {
+  uint32_t record_count;
+  uint32_t capacity;
+};
+static_assert(sizeof(ColumnarHeader) == 8, "ColumnarHeader must be 8 bytes.");
+
+// Data block in the PAX layout: the page holds a ColumnarHeader followed by
+// one array per column, each sized for the block's capacity:
+//   header | game_date_est[capacity] | team_id_home[capacity] | ...
+// Values are stored native-endian and every array is aligned to its width,
+// so the page is used in memory as-is and a column can be scanned in place.
+class ColumnarDataBlock {
+public:
+  // Create an empty block.
+  explicit ColumnarDataBlock(size_t page_size);
+  // Read the block from its page.
+  ColumnarDataBlock(int block_id, const PagedFile &file);
+  ~ColumnarDataBlock();
+
+  ColumnarDataBlock(const ColumnarDataBlock &) = delete;
+  ColumnarDataBlock &operator=(const ColumnarDataBlock &) = delete;
+
+  static constexpr bool FIXED_LAYOUT = true;
+  const char *page_data() const { return this->m_page; };
+  size_t page_size() const { return this->m_page_size; };
+
+  int id = -1;
+
+  static int max_records(size_t page_size);
+  size_t size() const { return this->header()->record_count; };
+  bool full() const;
+  void push_back(const Record &record);
+
+private:
+  ColumnarHeader *header() const {
+    return reinterpret_cast<ColumnarHeader *>(this->m_page);
+  };
+
+  char *m_page;
+  size_t m_page_size;
+};
+
+// Read-only access to the records of a block, backed by a cached DataBlock or
+// ColumnarDataBlock, or directly by a (memory mapped) page in either layout.
+// Fields are decoded on access, so scanning a single column neither copies
+// whole records nor allocates.
+class DataBlockView {
+public:
+  DataBlockView() {};
+  explicit DataBlockView(BlockRef<DataBlock> block);
+  explicit DataBlockView(BlockRef<ColumnarDataBlock> block);
+  // Serialized records of a page in the row layout.
+  DataBlockView(int id, const char *bytes, size_t length);
+  // Page in the columnar layout.
+  static DataBlockView from_columnar_page(int id, const char *page);
+
+  int id() const { return m_id; };
+  size_t size() const { return m_size; };
+
+  // Returns the values of a single column contiguously. Columnar blocks are
+  // read in place; otherwise only this column is decoded, into buffer. T must
+  // be the type of the column.
+  template <typename T>
+  const T *column(Column column, std::vector<T> &buffer) const;
+
+  uint32_t game_date_est(size_t i) const;
+  uint32_t team_id_home(size_t i) const;
+  float fg_pct_home(size_t i) const;
+  float ft_pct_home(size_t i) const;
+  float fg3_pct_home(size_t i) const;
+  uint16_t ast_home(size_t i) const;
+  uint16_t reb_home(size_t i) const;
+  uint16_t pts_home(size_t i) const;
+  bool home_team_wins(size_t i) const;
+  Record record(size_t i) const;
+
+private:
+  const char *field(size_t i, Column column) const {
+    return m_bytes + i * Record::SERIALIZED_SIZE + (size_t)column;
+  };
+  const char *column_start(Column column) const;
+  template <typename T> T column_value(Column column, size_t i) const;
+  template <typename T> void decode_column(Column column, T *values) const;
+
+  int m_id = -1;
+  size_t m_size = 0;
+  BlockRef<DataBlock> m_block;
+  BlockRef<ColumnarDataBlock> m_columnar_block;
+  const Record *m_records = nullptr;
+  // Row layout page.
+  const char *m_bytes = nullptr;
+  // Columnar layout page, and the capacity its columns are sized for.
+  const char *m_columns = nullptr;
+  size_t m_capacity = 0;
+};
+
+template <typename T>
+const T *DataBlockView::column(Column column, std::vector<T> &buffer) const {
+  if (!column_holds<T>(column))
+    throw std::invalid_argument("Column does not hold values of this type.");
+  if (m_columns)
+    return reinterpret_cast<const T *>(this->column_start(column));
+  buffer.resize(m_size);
+  this->decode_column(column, buffer.data());
+  return buffer.data();
+}
+
+// A single record inside a DataBlockView.
+struct RecordView {
+  const DataBlockView *block = nullptr;
+  size_t index = 0;
+
+  uint32_t game_date_est() const { return block->game_date_est(index); };
+  uint32_t team_id_home() const { return block->team_id_home(index); };
+  float fg_pct_home() const { return block->fg_pct_home(index); };
+  float ft_pct_home() const { return block->ft_pct_home(index); };
+  float fg3_pct_home() const { return block->fg3_pct_home(index); };
+  uint16_t ast_home() const { return block->ast_home(index); };
+  uint16_t reb_home() const { return block->reb_home(index); };
+  uint16_t pts_home() const { return block->pts_home(index); };
+  bool home_team_wins() const { return block->home_team_wins(index); };
+};
+
 std::vector<Record> read_records_from_file(const std::string &filename);
 
 #endif // DATA_BLOCK_H
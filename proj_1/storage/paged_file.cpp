@@ -0,0 +1,221 @@
+#include "paged_file.h"
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+// Preallocate this many pages at a time so that appending blocks does not
+// grow the file one page at a time.
+constexpr int PREALLOCATION_PAGES = 256;
+
+#ifdef _WIN32
+
+PagedFile::PagedFile(const std::string &path, size_t page_size, int page_count,
+                     bool read_only)
+    : m_path(path), m_page_size(page_size), m_read_only(read_only) {
+  m_handle = CreateFileA(
+      path.c_str(), read_only ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE,
+      FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+      read_only ? OPEN_EXISTING : OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (m_handle == INVALID_HANDLE_VALUE)
+    throw std::runtime_error("Error opening file " + path + ".");
+  m_allocated_pages = page_count;
+  if (read_only) {
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_handle, &size) ||
+        size.QuadPart < (long long)page_count * page_size)
+      throw std::runtime_error("File " + path + " is too small.");
+    return;
+  }
+  this->resize((long long)page_count * page_size);
+}
+
+PagedFile::~PagedFile() {
+  this->unmap();
+  CloseHandle(m_handle);
+}
+
+void PagedFile::map() {
+  if (!m_read_only)
+    throw std::runtime_error("Only read-only files can be mapped.");
+  if (m_mapping || m_allocated_pages == 0)
+    return;
+  m_mapping_handle =
+      CreateFileMappingA(m_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!m_mapping_handle)
+    throw std::runtime_error("Error mapping file " + m_path + ".");
+  m_mapping = (const char *)MapViewOfFile(m_mapping_handle, FILE_MAP_READ, 0,
+                                          0, (size_t)m_allocated_pages *
+                                                 m_page_size);
+  if (!m_mapping)
+    throw std::runtime_error("Error mapping file " + m_path + ".");
+}
+
+void PagedFile::unmap() {
+  if (m_mapping)
+    UnmapViewOfFile(m_mapping);
+  if (m_mapping_handle)
+    CloseHandle(m_mapping_handle);
+  m_mapping = nullptr;
+  m_mapping_handle = nullptr;
+}
+
+bool PagedFile::is_page_cached(int page_id) const { return false; }
+
+void PagedFile::resize(long long bytes) {
+  LARGE_INTEGER size;
+  size.QuadPart = bytes;
+  if (!SetFilePointerEx(m_handle, size, nullptr, FILE_BEGIN) ||
+      !SetEndOfFile(m_handle))
+    throw std::runtime_error("Error resizing file " + m_path + ".");
+}
+
+void PagedFile::read_page(int page_id, char *buffer) const {
+  long long offset = (long long)page_id * m_page_size;
+  OVERLAPPED overlapped{};
+  overlapped.Offset = (DWORD)(offset & 0xFFFFFFFF);
+  overlapped.OffsetHigh = (DWORD)(offset >> 32);
+  DWORD read = 0;
+  if (!ReadFile(m_handle, buffer, (DWORD)m_page_size, &read, &overlapped) ||
+      read != m_page_size)
+    throw std::runtime_error("Error reading page from " + m_path + ".");
+}
+
+void PagedFile::sync() {
+  if (!m_read_only && !FlushFileBuffers(m_handle))
+    throw std::runtime_error("Error syncing file " + m_path + ".");
+}
+
+void PagedFile::write_page(int page_id, const char *buffer) {
+  if (m_read_only)
+    throw std::runtime_error("Cannot write to read-only file " + m_path + ".");
+  long long offset = (long long)page_id * m_page_size;
+  OVERLAPPED overlapped{};
+  overlapped.Offset = (DWORD)(offset & 0xFFFFFFFF);
+  overlapped.OffsetHigh = (DWORD)(offset >> 32);
+  DWORD written = 0;
+  if (!WriteFile(m_handle, buffer, (DWORD)m_page_size, &written,
+                 &overlapped) ||
+      written != m_page_size)
+    throw std::runtime_error("Error writing page to " + m_path + ".");
+}
+
+#else
+
+PagedFile::PagedFile(const std::string &path, size_t page_size, int page_count,
+                     bool read_only)
+    : m_path(path), m_page_size(page_size), m_read_only(read_only) {
+  m_fd = open(path.c_str(), read_only ? O_RDONLY : O_RDWR | O_CREAT, 0644);
+  if (m_fd < 0)
+    throw std::runtime_error("Error opening file " + path + ".");
+  m_allocated_pages = page_count;
+  if (read_only) {
+    struct stat info;
+    if (fstat(m_fd, &info) != 0 ||
+        info.st_size < (off_t)page_count * (off_t)page_size)
+      throw std::runtime_error("File " + path + " is too small.");
+    return;
+  }
+  this->resize((long long)page_count * page_size);
+}
+
+PagedFile::~PagedFile() {
+  this->unmap();
+  close(m_fd);
+}
+
+void PagedFile::map() {
+  if (!m_read_only)
+    throw std::runtime_error("Only read-only files can be mapped.");
+  if (m_mapping || m_allocated_pages == 0)
+    return;
+  auto mapping = mmap(nullptr, (size_t)m_allocated_pages * m_page_size,
+                      PROT_READ, MAP_SHARED, m_fd, 0);
+  if (mapping == MAP_FAILED)
+    throw std::runtime_error("Error mapping file " + m_path + ".");
+  m_mapping = (const char *)mapping;
+}
+
+void PagedFile::unmap() {
+  if (m_mapping)
+    munmap((void *)m_mapping, (size_t)m_allocated_pages * m_page_size);
+  m_mapping = nullptr;
+}
+
+bool PagedFile::is_page_cached(int page_id) const {
+#ifdef RWF_NOWAIT
+  // A read which fails rather than wait for the disk. Pages are the size of a
+  // memory page, so one byte tells for the whole page.
+  char byte;
+  iovec vector{&byte, 1};
+  return preadv2(m_fd, &vector, 1, (off_t)page_id * m_page_size,
+                 RWF_NOWAIT) == 1;
+#else
+  return false;
+#endif
+}
+
+void PagedFile::resize(long long bytes) {
+  if (ftruncate(m_fd, bytes) != 0)
+    throw std::runtime_error("Error resizing file " + m_path + ".");
+#ifdef __linux__
+  // Ask the file system for real extents rather than a sparse file.
+  if (bytes > 0)
+    posix_fallocate(m_fd, 0, bytes);
+#endif
+}
+
+void PagedFile::read_page(int page_id, char *buffer) const {
+  off_t offset = (off_t)page_id * m_page_size;
+  size_t done = 0;
+  while (done < m_page_size) {
+    auto res = pread(m_fd, buffer + done, m_page_size - done, offset + done);
+    if (res < 0 && errno == EINTR)
+      continue;
+    if (res <= 0)
+      throw std::runtime_error("Error reading page from " + m_path + ".");
+    done += res;
+  }
+}
+
+void PagedFile::sync() {
+  if (!m_read_only && fsync(m_fd) != 0)
+    throw std::runtime_error("Error syncing file " + m_path + ".");
+}
+
+void PagedFile::write_page(int page_id, const char *buffer) {
+  if (m_read_only)
+    throw std::runtime_error("Cannot write to read-only file " + m_path + ".");
+  off_t offset = (off_t)page_id * m_page_size;
+  size_t done = 0;
+  while (done < m_page_size) {
+    auto res = pwrite(m_fd, buffer + done, m_page_size - done, offset + done);
+    if (res < 0 && errno == EINTR)
+      continue;
+    if (res <= 0)
+      throw std::runtime_error("Error writing page to " + m_path + ".");
+    done += res;
+  }
+}
+
+#endif
+
+void PagedFile::reserve(int page_count) {
+  if (page_count <= m_allocated_pages)
+    return;
+  if (m_read_only)
+    throw std::runtime_error("Cannot grow read-only file " + m_path + ".");
+  auto target = m_allocated_pages + PREALLOCATION_PAGES;
+  if (target < page_count)
+    target = page_count;
+  this->resize((long long)target * m_page_size);
+  m_allocated_pages = target;
+}
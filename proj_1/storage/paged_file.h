@@ -0,0 +1,76 @@
+#ifndef PAGED_FILE_H
+#define PAGED_FILE_H
+
+#include <cstddef>
+#include <streambuf>
+#include <string>
+
+// Every page starts with the length of the serialized block it holds.
+constexpr int PAGE_HEADER_SIZE = 4;
+
+// A single file holding fixed-size pages. Page N lives at byte offset
+// N * page_size, so reading or writing a page is a single positional syscall.
+class PagedFile {
+public:
+  // Opens (or creates) the file at path and resizes it to hold exactly
+  // page_count pages. Read-only files must already hold page_count pages and
+  // are never resized.
+  PagedFile(const std::string &path, size_t page_size, int page_count,
+            bool read_only = false);
+  ~PagedFile();
+
+  PagedFile(const PagedFile &) = delete;
+  PagedFile &operator=(const PagedFile &) = delete;
+
+  void read_page(int page_id, char *buffer) const;
+  void write_page(int page_id, const char *buffer);
+  // Whether the page is in the OS cache, so that reading it will not block on
+  // the disk. Always false where this cannot be checked.
+  bool is_page_cached(int page_id) const;
+  // Grows the file so that at least page_count pages are allocated on disk.
+  void reserve(int page_count);
+  // Waits for the writes so far to reach the disk.
+  void sync();
+
+  // Maps the whole file into memory. Only available for read-only files, as
+  // the mapping is not grown along with the file.
+  void map();
+  // Returns the start of a page inside the mapping.
+  const char *mapped_page(int page_id) const {
+    return m_mapping + (size_t)page_id * m_page_size;
+  };
+  bool is_mapped() const { return m_mapping != nullptr; };
+  bool is_read_only() const { return m_read_only; };
+
+  size_t page_size() const { return m_page_size; };
+
+private:
+  void resize(long long bytes);
+  void unmap();
+
+  std::string m_path;
+  size_t m_page_size;
+  int m_allocated_pages = 0;
+  bool m_read_only;
+  const char *m_mapping = nullptr;
+#ifdef _WIN32
+  void *m_handle;
+  void *m_mapping_handle = nullptr;
+#else
+  int m_fd;
+#endif
+};
+
+// Stream buffer over a fixed region of memory, used to run the existing
+// stream-based (de)serializers directly against a page buffer.
+class MemoryStreamBuf : public std::streambuf {
+public:
+  MemoryStreamBuf(char *begin, size_t size) {
+    setg(begin, begin, begin + size);
+    setp(begin, begin + size);
+  };
+
+  size_t written() const { return pptr() - pbase(); };
+};
+
+#endif // PAGED_FILE_H
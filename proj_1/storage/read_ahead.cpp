@@ -0,0 +1,38 @@
+#include "read_ahead.h"
+
+ReadAheadPool::~ReadAheadPool() {
+  {
+    std::lock_guard<std::mutex> guard(m_latch);
+    m_stopping = true;
+  }
+  m_ready.notify_all();
+  for (auto &thread : m_threads)
+    thread.join();
+}
+
+void ReadAheadPool::submit(std::function<void()> read) {
+  {
+    std::lock_guard<std::mutex> guard(m_latch);
+    m_queue.push_back(std::move(read));
+    if (m_threads.empty())
+      for (int i = 0; i < m_thread_count; ++i)
+        m_threads.emplace_back([this] { this->run(); });
+  }
+  m_ready.notify_one();
+}
+
+void ReadAheadPool::run() {
+  std::unique_lock<std::mutex> lock(m_latch);
+  while (true) {
+    m_ready.wait(lock, [this] { return m_stopping || !m_queue.empty(); });
+    // Queued reads are still run when stopping, as their blocks are reserved
+    // in the cache until the read completes.
+    if (m_queue.empty())
+      return;
+    auto read = std::move(m_queue.front());
+    m_queue.pop_front();
+    lock.unlock();
+    read();
+    lock.lock();
+  }
+}
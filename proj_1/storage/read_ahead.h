@@ -0,0 +1,41 @@
+#ifndef READ_AHEAD_H
+#define READ_AHEAD_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Reads are blocking, so a few threads keep several of them in flight.
+constexpr int READ_AHEAD_THREADS = 4;
+
+// Background threads which read blocks ahead of the threads that will use
+// them, so that computing on one block overlaps reading the next ones. Reads
+// are the same positional reads as a miss, which works on every platform; the
+// threads are only started once the first read is submitted.
+class ReadAheadPool {
+public:
+  ReadAheadPool(int thread_count = READ_AHEAD_THREADS)
+      : m_thread_count(thread_count) {};
+  // Finishes the reads already submitted.
+  ~ReadAheadPool();
+
+  ReadAheadPool(const ReadAheadPool &) = delete;
+  ReadAheadPool &operator=(const ReadAheadPool &) = delete;
+
+  void submit(std::function<void()> read);
+
+private:
+  void run();
+
+  std::mutex m_latch;
+  std::condition_variable m_ready;
+  std::deque<std::function<void()>> m_queue;
+  std::vector<std::thread> m_threads;
+  int m_thread_count;
+  bool m_stopping = false;
+};
+
+#endif // READ_AHEAD_H
@@ -1,7 +1,8 @@
 #include "serialize.h"
 #include <cstring>
 #include <iostream>
-static std::uint8_t buffer[8];
+// Per thread, as blocks may be decoded by several threads at once.
+static thread_local std::uint8_t buffer[8];
 
 namespace Serializer {
 std::uint8_t read_uint8(std::istream &stream) {
@@ -99,4 +100,31 @@ size_t write_bool(std::ostream &stream, bool x) {
   return write_uint8(stream, x);
 }
 
+std::uint16_t load_uint16(const char *data) {
+  auto bytes = reinterpret_cast<const std::uint8_t *>(data);
+  return ((uint16_t)bytes[0] << 8) | ((uint16_t)bytes[1]);
+}
+
+std::uint32_t load_uint32(const char *data) {
+  auto bytes = reinterpret_cast<const std::uint8_t *>(data);
+  return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) |
+         ((uint32_t)bytes[2] << 8) | ((uint32_t)bytes[3] << 0);
+}
+
+float load_float(const char *data) {
+  auto value = load_uint32(data);
+  float ret;
+  std::memcpy(&ret, &value, sizeof(float));
+  return ret;
+}
+
+uint64_t checksum(const char *data, size_t size) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= (uint8_t)data[i];
+    hash *= 0x100000001b3;
+  }
+  return hash;
+}
+
 }; // namespace Serializer
@@ -19,4 +19,13 @@ size_t write_float(std::ostream &, float);
 size_t write_double(std::ostream &, double);
 size_t write_bool(std::ostream &, bool);
 
+// Decode values in the same format directly from memory.
+std::uint16_t load_uint16(const char *);
+std::uint32_t load_uint32(const char *);
+float load_float(const char *);
+
+// FNV-1a hash of bytes, which catches the torn or partially written pages a
+// crash leaves.
+std::uint64_t checksum(const char *, size_t);
+
 }; // namespace Serializer
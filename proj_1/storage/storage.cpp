@@ -1,7 +1,13 @@
 #include "storage.h"
+#include "../hash_index.h"
 #include "../node.h"
 #include "data_block.h"
+#include <algorithm>
 #include <assert.h>
+#include <fstream>
+#include <set>
+#include <stdexcept>
+#include <type_traits>
 
 bool stream_just_ended(std::istream &stream) {
   // Ensure that we haven't read past the end of the file.
@@ -12,80 +18,773 @@ bool stream_just_ended(std::istream &stream) {
   return stream.eof();
 }
 
-int Storage::write_data_blocks(const std::vector<Record> &records) {
-  int max_records_per_block = DataBlock::max_records(this->block_size);
+// Defined here rather than in the header so that only this file needs the
+// block types complete.
+Storage::Storage(const std::string &storage_location, int data_block_count,
+                 int index_block_count, int overflow_block_count,
+                 size_t buffer_pool_bytes, StorageMode mode, DataLayout layout,
+                 int hash_block_count)
+    : Storage(storage_location, data_block_count, index_block_count,
+              overflow_block_count, buffer_pool_bytes, mode, layout,
+              hash_block_count, false) {}
+
+Storage::Storage(const std::string &storage_location, int data_block_count,
+                 int index_block_count, int overflow_block_count,
+                 size_t buffer_pool_bytes, StorageMode mode, DataLayout layout,
+                 int hash_block_count, bool keep_log)
+    : block_size(get_system_block_size()),
+      m_pool(buffer_pool_bytes, block_size),
+      m_index_blocks(&m_pool, storage_location + "index.dat", block_size,
+                     index_block_count, mode != StorageMode::ReadWrite),
+      m_overflow_blocks(&m_pool, storage_location + "overflow.dat",
+                        block_size, overflow_block_count,
+                        mode != StorageMode::ReadWrite),
+      m_hash_blocks(&m_pool, storage_location + "hash.dat", block_size,
+                    hash_block_count, mode != StorageMode::ReadWrite),
+      m_zone_map_file(storage_location + "zonemap.dat"),
+      m_log_file(storage_location + "wal.log"),
+      m_superblock_file(storage_location + "superblock.dat"),
+      m_read_only(mode != StorageMode::ReadWrite) {
+  m_buffer = new char[block_size]{};
+  auto data_file = storage_location + "data.dat";
+  auto read_only = mode != StorageMode::ReadWrite;
+  if (layout == DataLayout::Row)
+    m_data_blocks.emplace(&m_pool, data_file, block_size, data_block_count,
+                          read_only);
+  else
+    m_columnar_data_blocks.emplace(&m_pool, data_file, block_size,
+                                   data_block_count, read_only);
+  if (mode == StorageMode::ReadOnlyMapped && m_data_blocks)
+    m_data_blocks->map();
+  else if (mode == StorageMode::ReadOnlyMapped)
+    m_columnar_data_blocks->map();
+  if (data_block_count > 0)
+    load_zone_map();
+  // Copies left by an earlier run must not look newer than the next write.
+  if (auto previous = read_superblock(m_superblock_file))
+    m_superblock.sequence = previous->sequence;
+  // The files were just resized to the given counts, so neither the log nor
+  // the catalog of whatever was here before applies to them any more.
+  if (!keep_log && !m_read_only) {
+    LogFile(m_log_file).truncate();
+    this->write_superblock();
+  }
+}
+
+Storage::Storage(const std::string &storage_location,
+                 const Superblock &superblock, size_t buffer_pool_bytes,
+                 StorageMode mode)
+    : Storage(storage_location, superblock.data_block_count,
+              superblock.index_block_count, superblock.overflow_block_count,
+              buffer_pool_bytes, mode,
+              superblock.columnar ? DataLayout::Columnar : DataLayout::Row,
+              superblock.hash_block_count, true) {
+  this->number_of_records = superblock.record_count;
+  this->m_superblock = superblock;
+}
+
+// Whether file holds at least page_count pages of page_size bytes.
+static bool holds_pages(const std::string &file, int page_size,
+                        int page_count) {
+  std::ifstream stream(file, std::ios::binary | std::ios::ate);
+  std::streamoff size = stream ? (std::streamoff)stream.tellg() : 0;
+  return size >= (std::streamoff)page_size * page_count;
+}
+
+Storage Storage::open(const std::string &storage_location,
+                      size_t buffer_pool_bytes, StorageMode mode) {
+  auto superblock = read_superblock(storage_location + "superblock.dat");
+  if (!superblock)
+    throw std::runtime_error("No superblock at " + storage_location + ".");
+  // Checked before opening the files, which would otherwise be resized.
+  if (superblock->page_size != get_system_block_size())
+    throw std::runtime_error("The storage at " + storage_location +
+                             " was written with blocks of " +
+                             std::to_string(superblock->page_size) +
+                             " bytes.");
+  // Opening pads a short file with zeros, which would pass for blocks.
+  for (auto [name, count] :
+       {std::make_pair("data.dat", superblock->data_block_count),
+        std::make_pair("index.dat", superblock->index_block_count),
+        std::make_pair("overflow.dat", superblock->overflow_block_count),
+        std::make_pair("hash.dat", superblock->hash_block_count)})
+    if (!holds_pages(storage_location + name, superblock->page_size, count))
+      throw std::runtime_error("The storage at " + storage_location +
+                               " is missing blocks of " + name + ".");
+  return Storage(storage_location, *superblock, buffer_pool_bytes, mode);
+}
+
+bool Storage::exists(const std::string &storage_location) {
+  return read_superblock(storage_location + "superblock.dat").has_value();
+}
+
+std::optional<Superblock> Storage::read_superblock(const std::string &file) {
+  std::ifstream stream(file, std::ios::binary);
+  std::optional<Superblock> latest;
+  std::vector<char> page(SUPERBLOCK_SIZE);
+  for (int slot = 0; slot < 2; ++slot) {
+    if (!stream.read(page.data(), page.size()))
+      break;
+    auto superblock = Superblock::decode(page.data());
+    if (superblock && (!latest || superblock->sequence > latest->sequence))
+      latest = std::move(superblock);
+  }
+  return latest;
+}
+
+void Storage::encode_superblock(char *page) {
+  this->m_superblock.page_size = this->block_size;
+  this->m_superblock.columnar = this->data_layout() == DataLayout::Columnar;
+  this->m_superblock.record_count = this->number_of_records;
+  this->m_superblock.data_block_count = this->data_block_count();
+  this->m_superblock.index_block_count = this->index_block_count();
+  this->m_superblock.overflow_block_count = this->overflow_block_count();
+  this->m_superblock.hash_block_count = this->hash_block_count();
+  this->m_superblock.encode(page);
+}
+
+void Storage::write_superblock() {
+  if (this->m_read_only)
+    return;
+  std::lock_guard<std::mutex> guard(this->m_superblock_latch);
+  std::vector<char> page(SUPERBLOCK_SIZE);
+  ++this->m_superblock.sequence;
+  this->encode_superblock(page.data());
+  // Over the older copy, leaving the latest one whole if this write tears.
+  PagedFile file(this->m_superblock_file, SUPERBLOCK_SIZE, 2);
+  file.write_page(this->m_superblock.sequence % 2, page.data());
+  file.sync();
+  this->m_superblock_changed = false;
+}
+
+std::optional<TreeInfo> Storage::find_tree(const std::string &name) const {
+  std::lock_guard<std::mutex> guard(this->m_superblock_latch);
+  auto it = this->m_superblock.trees.find(name);
+  if (it == this->m_superblock.trees.end())
+    return std::nullopt;
+  return it->second;
+}
+
+void Storage::save_tree(const std::string &name, const TreeInfo &tree) {
+  std::lock_guard<std::mutex> guard(this->m_superblock_latch);
+  this->m_superblock.trees.insert_or_assign(name, tree);
+  this->m_superblock_changed = true;
+}
+
+std::optional<HashIndexInfo>
+Storage::find_hash_index(const std::string &name) const {
+  std::lock_guard<std::mutex> guard(this->m_superblock_latch);
+  auto it = this->m_superblock.hash_indexes.find(name);
+  if (it == this->m_superblock.hash_indexes.end())
+    return std::nullopt;
+  return it->second;
+}
+
+void Storage::save_hash_index(const std::string &name,
+                              const HashIndexInfo &index) {
+  std::lock_guard<std::mutex> guard(this->m_superblock_latch);
+  this->m_superblock.hash_indexes.insert_or_assign(name, index);
+  this->m_superblock_changed = true;
+}
+
+Storage::~Storage() {
+  // The writer uses the block storages, so it stops before they go.
+  m_background_writer.reset();
+  delete[] m_buffer;
+}
+
+template <typename Block>
+int Storage::write_data_blocks(BlockStorage<Block> &blocks,
+                               const std::vector<Record> &records) {
+  int max_records_per_block = this->records_per_data_block();
   int total_blocks = 0;
-  int total_records = 0;
 
-  DataBlock *block = new DataBlock();
+  auto create_block = [&]() -> Block * {
+    if constexpr (std::is_same_v<Block, DataBlock>)
+      return new DataBlock();
+    else
+      return new ColumnarDataBlock(this->block_size);
+  };
+  Block *block = create_block();
+  int block_records = 0;
+  // Blocks are appended after any already in the file.
+  int first_block = blocks.block_count();
+  BlockZone zone;
   for (const auto &record : records) {
-    block->records.push_back(record);
-    if (block->records.size() == max_records_per_block) {
-      this->m_data_blocks.track_new_block(block);
+    if constexpr (std::is_same_v<Block, DataBlock>)
+      block->records.push_back(record);
+    else
+      block->push_back(record);
+    ++block_records;
+    zone.add(record);
+    if (block_records == max_records_per_block) {
+      this->m_zone_map.set_zone(first_block + total_blocks, zone);
+      zone = BlockZone();
       ++total_blocks;
-      total_records += block->records.size();
-      block = new DataBlock();
+      // The block may be evicted (and written) as soon as it is unpinned.
+      blocks.track_new_block(block);
+      block = create_block();
+      block_records = 0;
     }
   }
 
   // Serialize partial block
-  if (!block->records.empty()) {
-    block->id = this->m_data_blocks.track_new_block(block);
+  if (block_records > 0) {
+    this->m_zone_map.set_zone(first_block + total_blocks, zone);
     ++total_blocks;
-    total_records += block->records.size();
+    blocks.track_new_block(block);
   } else {
     delete block;
   }
 
-  this->m_data_blocks.write_all_cached_blocks();
+  blocks.write_all_cached_blocks();
+  this->save_zone_map();
+  return total_blocks;
+}
+
+void Storage::load_zone_map() {
+  std::ifstream file(this->m_zone_map_file, std::ios::binary);
+  if (!file)
+    return;
+  this->m_zone_map = ZoneMap(file);
+}
+
+void Storage::save_zone_map() const {
+  std::ofstream file(this->m_zone_map_file,
+                     std::ios::binary | std::ios::trunc);
+  this->m_zone_map.write(file);
+  if (!file)
+    throw std::runtime_error("Could not write the zone map to " +
+                             this->m_zone_map_file + ".");
+}
+
+int Storage::write_data_blocks(const std::vector<Record> &records) {
+  if (this->m_log)
+    throw std::logic_error("Data blocks are written in bulk before logging "
+                           "is enabled.");
+  auto total_blocks = this->with_data_blocks(
+      [&](auto &blocks) { return this->write_data_blocks(blocks, records); });
+  this->number_of_records += records.size();
 
   std::cout << "Database file written successfully." << std::endl;
   std::cout << "Total blocks written: " << total_blocks << std::endl;
-  std::cout << "Total records written: " << total_records << std::endl;
+  std::cout << "Total records written: " << records.size() << std::endl;
 
   return total_blocks;
 }
 
-size_t Storage::loaded_index_block_count() const {
-  return this->m_index_blocks.loaded_block_count();
+template <typename Block>
+RecordPointer Storage::append_record(BlockStorage<Block> &blocks,
+                                     const Record &record) {
+  auto operation = this->begin_operation();
+  std::lock_guard<std::mutex> guard(this->m_append_latch);
+  auto size = [](const Block &block) -> int {
+    if constexpr (std::is_same_v<Block, DataBlock>)
+      return block.records.size();
+    else
+      return block.size();
+  };
+  BlockRef<Block> block;
+  if (blocks.block_count() > 0)
+    block = blocks.get(blocks.block_count() - 1);
+  if (block && size(*block) < this->records_per_data_block()) {
+    block.mark_dirty();
+  } else if constexpr (std::is_same_v<Block, DataBlock>) {
+    block = blocks.track_new_block(new DataBlock());
+  } else {
+    block = blocks.track_new_block(new ColumnarDataBlock(this->block_size));
+  }
+
+  RecordPointer pointer{.block_id = block->id, .offset = size(*block)};
+  if constexpr (std::is_same_v<Block, DataBlock>)
+    block->records.push_back(record);
+  else
+    block->push_back(record);
+  auto zone = (size_t)block->id < this->m_zone_map.block_count()
+                  ? this->m_zone_map.zone(block->id)
+                  : BlockZone();
+  zone.add(record);
+  this->m_zone_map.set_zone(block->id, zone);
+  std::lock_guard<std::mutex> superblock_guard(this->m_superblock_latch);
+  ++this->number_of_records;
+  this->m_superblock_changed = true;
+  return pointer;
+}
+
+RecordPointer Storage::append_record(const Record &record) {
+  return this->with_data_blocks(
+      [&](auto &blocks) { return this->append_record(blocks, record); });
+}
+
+// Storage whose operation the thread is in, if any, so that operations it
+// starts inside it do not wait for the gate.
+static thread_local const Storage *t_operation_storage = nullptr;
+
+Storage::Operation Storage::begin_operation() {
+  if (t_operation_storage == this)
+    return Operation(nullptr);
+  // Log in batches along the way, so that blocks waiting for their image to
+  // be logged never fill the pool.
+  if (this->m_log &&
+      this->m_pool.unlogged_count() > this->m_pool.frame_count() / 4) {
+    this->log_changes();
+  }
+  std::unique_lock<std::mutex> lock(this->m_operation_latch);
+  this->m_operations_changed.wait(
+      lock, [this] { return !this->m_operations_paused; });
+  ++this->m_active_operations;
+  t_operation_storage = this;
+  return Operation(this);
+}
+
+Storage::Operation::~Operation() {
+  if (!this->m_storage)
+    return;
+  auto storage = this->m_storage;
+  t_operation_storage = nullptr;
+  std::lock_guard<std::mutex> guard(storage->m_operation_latch);
+  if (--storage->m_active_operations == 0)
+    storage->m_operations_changed.notify_all();
+}
+
+void Storage::pause_operations() {
+  if (t_operation_storage == this)
+    throw std::logic_error("Cannot wait for operations from within one.");
+  std::unique_lock<std::mutex> lock(this->m_operation_latch);
+  this->m_operations_changed.wait(
+      lock, [this] { return !this->m_operations_paused; });
+  this->m_operations_paused = true;
+  this->m_operations_changed.wait(
+      lock, [this] { return this->m_active_operations == 0; });
+}
+
+void Storage::resume_operations() {
+  std::lock_guard<std::mutex> guard(this->m_operation_latch);
+  this->m_operations_paused = false;
+  this->m_operations_changed.notify_all();
 }
-size_t Storage::loaded_data_block_count() const {
-  return this->m_data_blocks.loaded_block_count();
+
+uint64_t Storage::log_changes() {
+  this->pause_operations();
+  uint64_t lsn;
+  try {
+    lsn = this->capture_changes();
+  } catch (...) {
+    this->resume_operations();
+    throw;
+  }
+  this->resume_operations();
+  return lsn;
 }
+
+uint64_t Storage::capture_changes() {
+  assert(this->m_log && this->m_operations_paused);
+  auto kind_of = [this](const BlockStorageBase *owner) {
+    if (owner == &this->m_index_blocks)
+      return LogFileKind::Index;
+    if (owner == &this->m_overflow_blocks)
+      return LogFileKind::Overflow;
+    if (owner == &this->m_hash_blocks)
+      return LogFileKind::Hash;
+    return LogFileKind::Data;
+  };
+  std::lock_guard<std::mutex> guard(this->m_pool.latch());
+  auto frames = this->m_pool.take_unlogged();
+  std::vector<PageImage> images(frames.size());
+  for (size_t i = 0; i < frames.size(); ++i) {
+    images[i].kind = kind_of(frames[i]->owner);
+    images[i].block_id = frames[i]->block_id;
+    images[i].page.resize(this->block_size);
+    frames[i]->owner->copy_page(frames[i]->block_id, images[i].page.data());
+  }
+  {
+    // Roots that moved and records appended.
+    std::lock_guard<std::mutex> superblock_guard(this->m_superblock_latch);
+    if (this->m_superblock_changed) {
+      assert(this->block_size >= (int)SUPERBLOCK_SIZE);
+      PageImage image{LogFileKind::Superblock, 0,
+                      std::vector<char>(this->block_size)};
+      this->encode_superblock(image.page.data());
+      images.push_back(std::move(image));
+      this->m_superblock_changed = false;
+    }
+  }
+  if (images.empty())
+    return this->m_log->last_lsn();
+  auto lsn = this->m_log->append(images);
+  for (auto frame : frames)
+    frame->lsn = lsn;
+  return lsn;
+}
+
+size_t Storage::enable_logging() {
+  if (this->m_log)
+    throw std::logic_error("Logging is already enabled.");
+  if (this->with_data_blocks([](auto &blocks) { return blocks.is_mapped(); }))
+    throw std::logic_error("Cannot log changes to read-only storage.");
+
+  // Pages are restored under the cache, so it must not hold any.
+  this->flush_blocks();
+  auto log = std::make_unique<WriteAheadLog>(this->m_log_file,
+                                             this->block_size);
+  std::set<int> data_blocks;
+  std::optional<Superblock> recovered;
+  auto batches = log->replay([&](const PageImage &image) {
+    auto page = image.page.data();
+    switch (image.kind) {
+    case LogFileKind::Data:
+      this->with_data_blocks(
+          [&](auto &blocks) { blocks.restore_page(image.block_id, page); });
+      data_blocks.insert(image.block_id);
+      break;
+    case LogFileKind::Index:
+      this->m_index_blocks.restore_page(image.block_id, page);
+      break;
+    case LogFileKind::Overflow:
+      this->m_overflow_blocks.restore_page(image.block_id, page);
+      break;
+    case LogFileKind::Hash:
+      this->m_hash_blocks.restore_page(image.block_id, page);
+      break;
+    case LogFileKind::Superblock:
+      recovered = Superblock::decode(page);
+      if (!recovered)
+        throw std::runtime_error("Corrupted log " + this->m_log_file + ".");
+      break;
+    default:
+      throw std::runtime_error("Corrupted log " + this->m_log_file + ".");
+    }
+  });
+
+  if (batches > 0) {
+    this->sync_files();
+    if (recovered) {
+      std::lock_guard<std::mutex> guard(this->m_superblock_latch);
+      this->number_of_records = recovered->record_count;
+      this->m_superblock.trees = recovered->trees;
+      this->m_superblock.hash_indexes = recovered->hash_indexes;
+    }
+    this->write_superblock();
+    // The zone map is only saved at checkpoints, so it misses the records
+    // appended since.
+    for (auto id : data_blocks) {
+      auto block = this->get_data_block_view(id);
+      BlockZone zone;
+      for (size_t i = 0; i < block.size(); ++i)
+        zone.add(block.record(i));
+      this->m_zone_map.set_zone(id, zone);
+    }
+    this->flush_cache_without_writing();
+    this->save_zone_map();
+  }
+  // Even without a complete batch, a torn one may be left, which would end
+  // the replay of the batches appended after it.
+  log->truncate();
+  this->m_log = std::move(log);
+  this->m_pool.set_log(this->m_log.get());
+  return batches;
+}
+
+void Storage::sync_files() {
+  this->with_data_blocks([](auto &blocks) { blocks.sync(); });
+  this->m_index_blocks.sync();
+  this->m_overflow_blocks.sync();
+  this->m_hash_blocks.sync();
+}
+
+LogStats Storage::log_stats() const {
+  return this->m_log ? this->m_log->stats() : LogStats();
+}
+
+uint64_t Storage::log_size() const {
+  return this->m_log ? this->m_log->size() : 0;
+}
+
+size_t Storage::write_dirty_blocks(size_t max_blocks) {
+  std::lock_guard<std::mutex> writer_guard(this->m_writer_latch);
+  std::vector<Frame *> frames;
+  std::vector<std::vector<char>> pages;
+  uint64_t lsn = 0;
+  // Gives the blocks not written back their changes, and unpins them all.
+  auto release = [&](size_t written) {
+    for (size_t i = 0; i < frames.size(); ++i) {
+      if (i >= written)
+        frames[i]->dirty = true;
+      --frames[i]->pin_count;
+    }
+  };
+
+  // Between operations, so that no page is copied halfway through a change.
+  this->pause_operations();
+  try {
+    if (this->m_log)
+      lsn = this->capture_changes();
+    std::lock_guard<std::mutex> guard(this->m_pool.latch());
+    frames = this->m_pool.take_dirty(max_blocks);
+    // In file order, so that each file is written sequentially.
+    std::sort(frames.begin(), frames.end(), [](Frame *a, Frame *b) {
+      return std::make_pair(a->owner, a->block_id) <
+             std::make_pair(b->owner, b->block_id);
+    });
+    pages.resize(frames.size());
+    for (size_t i = 0; i < frames.size(); ++i) {
+      pages[i].resize(this->block_size);
+      frames[i]->owner->copy_page(frames[i]->block_id, pages[i].data());
+    }
+  } catch (...) {
+    release(0);
+    this->resume_operations();
+    throw;
+  }
+  this->resume_operations();
+
+  size_t written = 0;
+  try {
+    if (this->m_log && !frames.empty())
+      this->m_log->flush(lsn);
+    for (; written < frames.size(); ++written)
+      frames[written]->owner->write_page(frames[written]->block_id,
+                                         pages[written].data());
+  } catch (...) {
+    release(written);
+    throw;
+  }
+  release(written);
+  return written;
+}
+
+void Storage::start_background_writer(BackgroundWriterOptions options) {
+  if (this->m_background_writer)
+    this->m_background_writer->stop();
+  this->m_background_writer =
+      std::make_unique<BackgroundWriter>(this, options);
+}
+
+void Storage::stop_background_writer() {
+  if (this->m_background_writer)
+    this->m_background_writer->stop();
+}
+
+BackgroundWriterStats Storage::background_writer_stats() const {
+  return this->m_background_writer ? this->m_background_writer->stats()
+                                   : BackgroundWriterStats();
+}
+
+void Storage::commit() {
+  if (!this->m_log)
+    throw std::logic_error("Logging is not enabled.");
+  auto lsn = this->log_changes();
+  // Outside the gate, so that operations go on while the log syncs.
+  this->m_log->flush(lsn);
+}
+
+void Storage::checkpoint() {
+  if (!this->m_log)
+    throw std::logic_error("Logging is not enabled.");
+  std::lock_guard<std::mutex> guard(this->m_writer_latch);
+  this->write_checkpoint();
+}
+
+void Storage::write_checkpoint() {
+  this->pause_operations();
+  try {
+    this->m_log->flush(this->capture_changes());
+    this->with_data_blocks(
+        [](auto &blocks) { blocks.write_all_cached_blocks(); });
+    this->m_index_blocks.write_all_cached_blocks();
+    this->m_overflow_blocks.write_all_cached_blocks();
+    this->m_hash_blocks.write_all_cached_blocks();
+    this->sync_files();
+    this->write_superblock();
+    this->save_zone_map();
+    this->m_log->truncate();
+  } catch (...) {
+    this->resume_operations();
+    throw;
+  }
+  this->resume_operations();
+}
+
+DataLayout Storage::data_layout() const {
+  return this->m_data_blocks ? DataLayout::Row : DataLayout::Columnar;
+}
+
+int Storage::records_per_data_block() const {
+  if (this->m_data_blocks)
+    return DataBlock::max_records(this->usable_block_size());
+  return ColumnarDataBlock::max_records(this->block_size);
+}
+
+int Storage::data_block_count() const {
+  return this->with_data_blocks(
+      [](auto &blocks) { return blocks.block_count(); });
+}
+int Storage::index_block_count() const {
+  return this->m_index_blocks.block_count();
+}
+int Storage::overflow_block_count() const {
+  return this->m_overflow_blocks.block_count();
+}
+int Storage::hash_block_count() const {
+  return this->m_hash_blocks.block_count();
+}
+
+const CacheStats &Storage::data_block_stats() const {
+  return this->with_data_blocks(
+      [](auto &blocks) -> const CacheStats & { return blocks.stats(); });
+}
+const CacheStats &Storage::index_block_stats() const {
+  return this->m_index_blocks.stats();
+}
+const CacheStats &Storage::overflow_block_stats() const {
+  return this->m_overflow_blocks.stats();
+}
+const CacheStats &Storage::hash_block_stats() const {
+  return this->m_hash_blocks.stats();
+}
+
+void Storage::reset_stats() {
+  this->with_data_blocks([](auto &blocks) { blocks.reset_stats(); });
+  this->m_index_blocks.reset_stats();
+  this->m_overflow_blocks.reset_stats();
+  this->m_hash_blocks.reset_stats();
+}
+
 void Storage::flush_blocks() {
-  this->m_index_blocks.write_all_cached_blocks();
-  this->m_data_blocks.write_all_cached_blocks();
-  this->m_overflow_blocks.write_all_cached_blocks();
+  std::lock_guard<std::mutex> guard(this->m_writer_latch);
+  if (this->m_log) {
+    // Blocks changed since their image was logged are only written once it
+    // is. The checkpoint also syncs the files and writes the superblock.
+    this->write_checkpoint();
+  } else {
+    this->m_index_blocks.write_all_cached_blocks();
+    this->with_data_blocks(
+        [](auto &blocks) { blocks.write_all_cached_blocks(); });
+    this->m_overflow_blocks.write_all_cached_blocks();
+    this->m_hash_blocks.write_all_cached_blocks();
+    this->sync_files();
+    // Last, so that it never refers to blocks not yet on disk.
+    this->write_superblock();
+  }
   this->m_index_blocks.delete_all_blocks_without_writing();
-  this->m_data_blocks.delete_all_blocks_without_writing();
+  this->with_data_blocks(
+      [](auto &blocks) { blocks.delete_all_blocks_without_writing(); });
   this->m_overflow_blocks.delete_all_blocks_without_writing();
+  this->m_hash_blocks.delete_all_blocks_without_writing();
 }
 
 void Storage::flush_cache_without_writing() {
+  std::lock_guard<std::mutex> guard(this->m_writer_latch);
   this->m_index_blocks.delete_all_blocks_without_writing();
-  this->m_data_blocks.delete_all_blocks_without_writing();
+  this->with_data_blocks(
+      [](auto &blocks) { blocks.delete_all_blocks_without_writing(); });
   this->m_overflow_blocks.delete_all_blocks_without_writing();
+  this->m_hash_blocks.delete_all_blocks_without_writing();
 }
 
-DataBlock *Storage::get_data_block(int id) {
-  return this->m_data_blocks.get(id);
+BlockRef<DataBlock> Storage::get_data_block(int id) {
+  if (!this->m_data_blocks)
+    throw std::logic_error("Data blocks are not stored row by row.");
+  return this->m_data_blocks->get(id);
 }
 
-Node *Storage::get_index_block(int id) { return this->m_index_blocks.get(id); }
+DataBlockView Storage::get_data_block_view(int id) {
+  if (this->m_columnar_data_blocks) {
+    if (!this->m_columnar_data_blocks->is_mapped())
+      return DataBlockView(this->m_columnar_data_blocks->get(id));
+    auto page = this->m_columnar_data_blocks->get_mapped(id);
+    return DataBlockView::from_columnar_page(id, page.data());
+  }
+  if (!this->m_data_blocks->is_mapped())
+    return DataBlockView(this->m_data_blocks->get(id));
+  auto bytes = this->m_data_blocks->get_mapped(id);
+  return DataBlockView(id, bytes.data(), bytes.size());
+}
+
+BlockRef<Node> Storage::get_index_block(int id) {
+  return this->m_index_blocks.get(id);
+}
 
-OverflowBlock *Storage::get_overflow_block(int id) {
+BlockRef<OverflowBlock> Storage::get_overflow_block(int id) {
   return this->m_overflow_blocks.get(id);
 }
 
-int Storage::track_new_data_block(DataBlock *b) {
-  return this->m_data_blocks.track_new_block(b);
+BlockRef<HashPage> Storage::get_hash_block(int id) {
+  return this->m_hash_blocks.get(id);
+}
+
+void Storage::prefetch_data_blocks(const std::vector<int> &ids) {
+  this->with_data_blocks([&](auto &blocks) {
+    blocks.prefetch(ids, this->m_read_ahead_pool);
+  });
+}
+
+void Storage::prefetch_index_blocks(const std::vector<int> &ids) {
+  this->m_index_blocks.prefetch(ids, this->m_read_ahead_pool);
+}
+
+void Storage::read_ahead_data_blocks(int id) {
+  // Only every read_ahead() blocks, each time requesting the next two
+  // windows, so that between one and two windows are always being read.
+  auto distance = this->m_read_ahead;
+  if (distance <= 0 || id % distance != 0)
+    return;
+  std::vector<int> ids;
+  auto last = std::min(id + 2 * distance, this->data_block_count());
+  for (auto i = id + 1; i < last; ++i)
+    ids.push_back(i);
+  this->prefetch_data_blocks(ids);
+}
+
+void Storage::read_ahead_data_blocks(const std::vector<int> &ids,
+                                     size_t position) {
+  auto distance = (size_t)std::max(this->m_read_ahead, 0);
+  if (distance == 0 || position % distance != 0)
+    return;
+  auto last = std::min(position + 2 * distance, ids.size());
+  if (position + 1 < last)
+    this->prefetch_data_blocks(
+        {ids.begin() + position + 1, ids.begin() + last});
+}
+
+void Storage::read_ahead_leaves(NodePointer next) {
+  if (this->m_read_ahead <= 0)
+    return;
+  // The chain is followed under the pool latch, which inserts take after
+  // latching a node, so a leaf being modified ends the read-ahead instead of
+  // waiting for it.
+  auto next_leaf = [](const Node &node) {
+    std::shared_lock<std::shared_mutex> lock(node.latch(), std::try_to_lock);
+    return lock ? node.next_node_pointer().block_id : -1;
+  };
+  this->m_index_blocks.prefetch_chain(next.block_id, this->m_read_ahead,
+                                      next_leaf, this->m_read_ahead_pool);
+}
+
+BlockRef<DataBlock> Storage::track_new_data_block(DataBlock *b) {
+  if (!this->m_data_blocks)
+    throw std::logic_error("Data blocks are not stored row by row.");
+  return this->m_data_blocks->track_new_block(b);
 };
-int Storage::track_new_index_block(Node *b) {
+BlockRef<Node> Storage::track_new_index_block(Node *b) {
   return this->m_index_blocks.track_new_block(b);
 };
-int Storage::track_new_overflow_block(OverflowBlock *b) {
+BlockRef<OverflowBlock> Storage::track_new_overflow_block(OverflowBlock *b) {
   return this->m_overflow_blocks.track_new_block(b);
 };
+BlockRef<HashPage> Storage::track_new_hash_block(HashPage *b) {
+  return this->m_hash_blocks.track_new_block(b);
+};
+
+void Storage::mark_index_block_dirty(int id) {
+  this->m_index_blocks.mark_dirty(id);
+}
+void Storage::mark_overflow_block_dirty(int id) {
+  this->m_overflow_blocks.mark_dirty(id);
+}
+void Storage::mark_hash_block_dirty(int id) {
+  this->m_hash_blocks.mark_dirty(id);
+}
 
 #ifdef _WIN32
 #include <Windows.h>
@@ -118,6 +817,5 @@ int Storage::get_system_block_size(void) {
             << std::endl;
 #endif
 
-  std::cout << "System block size: " << block_size << " byte" << std::endl;
   return block_size;
 }
@@ -2,20 +2,51 @@
 #define STORAGE_H
 
 #include <chrono>
+#include <condition_variable>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <vector>
 
+#include "../posting_list.h"
+#include "background_writer.h"
 #include "block_storage_impl.h"
 #include "data_block.h"
+#include "read_ahead.h"
+#include "superblock.h"
+#include "wal.h"
+#include "zone_map.h"
 
 bool stream_just_ended(std::istream &stream);
 
 struct OverflowBlock;
 class Node;
+class HashPage;
+struct NodePointer;
+
+// Scans keep this many blocks ahead of them being read unless configured
+// otherwise.
+constexpr int DEFAULT_READ_AHEAD_BLOCKS = 8;
+
+enum class StorageMode {
+  ReadWrite,
+  // Opens existing files read-only. Data blocks are memory mapped and read in
+  // place through get_data_block_view.
+  ReadOnlyMapped,
+};
+
+enum class DataLayout {
+  // Records are serialized one after another (DataBlock).
+  Row,
+  // Each column is stored contiguously within the block (ColumnarDataBlock),
+  // so scanning a few columns only touches those.
+  Columnar,
+};
 
 class Storage {
 public:
@@ -23,38 +54,229 @@ public:
 
   int block_size;
 
+  // Opens the files at storage_location with the given block counts, as a
+  // new storage: the log of whatever was there before is emptied, as its
+  // pages may no longer match, and its superblock replaced by an empty
+  // catalog. Use open to recover from the log instead.
   Storage(const std::string &storage_location, int data_block_count,
-          int index_block_count, int overflow_block_count)
-      : block_size(get_system_block_size()),
-        m_data_blocks(storage_location + "data_", data_block_count),
-        m_index_blocks(storage_location + "index_", index_block_count),
-        m_overflow_blocks(storage_location + "overflow_",
-                          overflow_block_count) {
-    m_buffer = new char[block_size]{};
-  };
-  ~Storage() { delete[] m_buffer; };
+          int index_block_count, int overflow_block_count,
+          size_t buffer_pool_bytes = DEFAULT_BUFFER_POOL_BYTES,
+          StorageMode mode = StorageMode::ReadWrite,
+          DataLayout layout = DataLayout::Row, int hash_block_count = 0);
+  ~Storage();
+
+  // Opens the storage a previous run left at storage_location, with the
+  // block counts and data layout its superblock recorded at the last flush
+  // or checkpoint. enable_logging then recovers what changed since. Throws if
+  // a file is shorter than its block count.
+  static Storage open(const std::string &storage_location,
+                      size_t buffer_pool_bytes = DEFAULT_BUFFER_POOL_BYTES,
+                      StorageMode mode = StorageMode::ReadWrite);
+  // Whether a superblock was written at storage_location.
+  static bool exists(const std::string &storage_location);
+
+  // Indexes recorded in the superblock by name, to be opened again.
+  std::optional<TreeInfo> find_tree(const std::string &name) const;
+  void save_tree(const std::string &name, const TreeInfo &tree);
+  std::optional<HashIndexInfo> find_hash_index(const std::string &name) const;
+  void save_hash_index(const std::string &name, const HashIndexInfo &index);
+
+  // Bytes of a block available to the serialized contents, excluding the
+  // page header.
+  int usable_block_size() const { return block_size - PAGE_HEADER_SIZE; };
+
+  DataLayout data_layout() const;
+  // Records that fit in a data block in the current layout.
+  int records_per_data_block() const;
+
+  // Only available with the row layout.
+  BlockRef<DataBlock> get_data_block(int id);
+  // Read-only view of a data block. In ReadOnlyMapped mode this reads the
+  // page in place, otherwise it pins the cached block.
+  DataBlockView get_data_block_view(int id);
+  BlockRef<Node> get_index_block(int id);
+  BlockRef<OverflowBlock> get_overflow_block(int id);
+  BlockRef<HashPage> get_hash_block(int id);
+
+  // Starts reading the given blocks in the background, so that getting them
+  // later does not wait for I/O.
+  void prefetch_data_blocks(const std::vector<int> &ids);
+  void prefetch_index_blocks(const std::vector<int> &ids);
+  // Called by sequential scans over the data blocks as they reach block id,
+  // to keep up to read_ahead() of the following blocks being read.
+  void read_ahead_data_blocks(int id);
+  // The same for scans over only the given blocks, as they reach
+  // ids[position].
+  void read_ahead_data_blocks(const std::vector<int> &ids, size_t position);
+  // Called by walks along the leaf chain to read up to read_ahead() leaves
+  // ahead, starting at next.
+  void read_ahead_leaves(NodePointer next);
+  // Number of blocks scans read ahead. Zero disables read-ahead.
+  int read_ahead() const { return m_read_ahead; };
+  void set_read_ahead(int blocks) { m_read_ahead = blocks; };
 
-  DataBlock *get_data_block(int id);
-  Node *get_index_block(int id);
-  OverflowBlock *get_overflow_block(int id);
+  BlockRef<DataBlock> track_new_data_block(DataBlock *b);
+  BlockRef<Node> track_new_index_block(Node *b);
+  BlockRef<OverflowBlock> track_new_overflow_block(OverflowBlock *b);
+  BlockRef<HashPage> track_new_hash_block(HashPage *b);
 
-  int track_new_data_block(DataBlock *b);
-  int track_new_index_block(Node *b);
-  int track_new_overflow_block(OverflowBlock *b);
+  void mark_index_block_dirty(int id);
+  void mark_overflow_block_dirty(int id);
+  void mark_hash_block_dirty(int id);
 
-  size_t loaded_index_block_count() const;
-  size_t loaded_data_block_count() const;
+  int data_block_count() const;
+  int index_block_count() const;
+  int overflow_block_count() const;
+  int hash_block_count() const;
+  const CacheStats &data_block_stats() const;
+  const CacheStats &index_block_stats() const;
+  const CacheStats &overflow_block_stats() const;
+  const CacheStats &hash_block_stats() const;
+  void reset_stats();
+
+  // Writes every changed block. Only those changed since they were last
+  // written are, so after the initial load a flush is proportional to what
+  // changed.
   void flush_blocks();
   void flush_cache_without_writing();
+  // Writes up to max_blocks of the changed blocks in place, between
+  // operations, and returns how many. When logging, the changes not yet
+  // logged are logged first, and the log synced before the blocks are
+  // written.
+  size_t write_dirty_blocks(size_t max_blocks);
+  // Starts writing changed blocks in the background. Bulk loading must be
+  // done first, as it changes blocks outside of operations.
+  void start_background_writer(BackgroundWriterOptions options = {});
+  // Stops it, rethrowing the error that stopped it, if any.
+  void stop_background_writer();
+  // Of the writer running or last stopped.
+  BackgroundWriterStats background_writer_stats() const;
+  // Also builds and saves the zone map of the written blocks.
   int write_data_blocks(const std::vector<Record> &records);
+  // Per block bounds of each column. Blocks missing from it, for example
+  // those of files written before zone maps, are never pruned.
+  const ZoneMap &zone_map() const { return this->m_zone_map; };
+
+  // Adds a record after the last one of the data blocks, starting a new
+  // block when the last is full, and returns where it went. Must not run
+  // concurrently with scans over the data blocks.
+  RecordPointer append_record(const Record &record);
+
+  // Opens the write-ahead log next to the files, first redoing what it holds
+  // from before a crash. From then on the pages changed by operations are
+  // logged, and commit makes every operation finished so far durable without
+  // writing the pages in place. Meant to be called once the bulk loading is
+  // done: blocks changed but not yet logged are never evicted. Returns the
+  // number of batches redone.
+  size_t enable_logging();
+  bool logging() const { return this->m_log != nullptr; };
+  LogStats log_stats() const;
+  uint64_t log_size() const;
+
+  // Held by every change that must reach the log whole (an insert or an
+  // append), so that the pages logged never show half of one. Operations of
+  // a thread nest.
+  class Operation {
+  public:
+    Operation(const Operation &) = delete;
+    Operation &operator=(const Operation &) = delete;
+    ~Operation();
+
+  private:
+    friend class Storage;
+    explicit Operation(Storage *storage) : m_storage(storage) {};
+    Storage *m_storage;
+  };
+  Operation begin_operation();
+
+  // Makes every operation finished before the call durable. Commits from
+  // several threads share the sync.
+  void commit();
+  // Writes every logged block in place and empties the log.
+  void checkpoint();
 
 private:
-  int get_system_block_size();
+  Storage(const std::string &storage_location, int data_block_count,
+          int index_block_count, int overflow_block_count,
+          size_t buffer_pool_bytes, StorageMode mode, DataLayout layout,
+          int hash_block_count, bool keep_log);
+  Storage(const std::string &storage_location, const Superblock &superblock,
+          size_t buffer_pool_bytes, StorageMode mode);
+  static int get_system_block_size();
+  // The latest whole copy in the superblock file, if any.
+  static std::optional<Superblock> read_superblock(const std::string &file);
+  // Expects the superblock latch to be held.
+  void encode_superblock(char *page);
+  // Writes the superblock over its older copy and syncs it.
+  void write_superblock();
+  void sync_files();
+  // Logs the images of the blocks changed since the last call, between
+  // operations, and returns the sequence number of the batch (or of the last
+  // one if nothing changed).
+  uint64_t log_changes();
+  // The same, expecting operations to be paused.
+  uint64_t capture_changes();
+  // Checkpoints, expecting the writer latch to be held.
+  void write_checkpoint();
+  // Waits for the running operations to end and keeps new ones from
+  // starting until resume_operations.
+  void pause_operations();
+  void resume_operations();
+  template <typename Block>
+  RecordPointer append_record(BlockStorage<Block> &blocks,
+                              const Record &record);
+  void load_zone_map();
+  void save_zone_map() const;
+  template <typename Block>
+  int write_data_blocks(BlockStorage<Block> &blocks,
+                        const std::vector<Record> &records);
+
+  // Calls f with whichever data block storage the layout uses.
+  template <typename F> decltype(auto) with_data_blocks(F f) {
+    if (m_data_blocks)
+      return f(*m_data_blocks);
+    return f(*m_columnar_data_blocks);
+  };
+  template <typename F> decltype(auto) with_data_blocks(F f) const {
+    if (m_data_blocks)
+      return f(*m_data_blocks);
+    return f(*m_columnar_data_blocks);
+  };
 
-  BlockStorage<DataBlock> m_data_blocks;
+  BufferPool m_pool;
+  // Exactly one of these is used, depending on the data layout.
+  std::optional<BlockStorage<DataBlock>> m_data_blocks;
+  std::optional<BlockStorage<ColumnarDataBlock>> m_columnar_data_blocks;
   BlockStorage<Node> m_index_blocks;
   BlockStorage<OverflowBlock> m_overflow_blocks;
+  // Pages of the hash indexes, both buckets and directories.
+  BlockStorage<HashPage> m_hash_blocks;
   char *m_buffer;
+  std::string m_zone_map_file;
+  ZoneMap m_zone_map;
+  int m_read_ahead = DEFAULT_READ_AHEAD_BLOCKS;
+  std::string m_log_file;
+  std::unique_ptr<WriteAheadLog> m_log;
+  std::mutex m_append_latch;
+  // Gate between operations and the capture of their pages.
+  std::mutex m_operation_latch;
+  std::condition_variable m_operations_changed;
+  int m_active_operations = 0;
+  bool m_operations_paused = false;
+  // Held while writing blocks in place, so that an older copy of a block
+  // taken by write_dirty_blocks never lands after a newer one.
+  std::mutex m_writer_latch;
+  std::unique_ptr<BackgroundWriter> m_background_writer;
+  std::string m_superblock_file;
+  bool m_read_only;
+  // Guards the catalog of m_superblock and number_of_records.
+  mutable std::mutex m_superblock_latch;
+  Superblock m_superblock;
+  // Changed since last logged or written.
+  bool m_superblock_changed = false;
+  // Declared last so that it finishes its reads before the block storages it
+  // reads into are destroyed.
+  ReadAheadPool m_read_ahead_pool;
 };
 
 #endif // STORAGE_H
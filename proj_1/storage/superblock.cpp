@@ -0,0 +1,128 @@
+#include "superblock.h"
+#include "serialize.h"
+#include "zone_map.h"
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+constexpr uint32_t SUPERBLOCK_MAGIC = 0x53555042;
+constexpr uint32_t SUPERBLOCK_VERSION = 1;
+// Magic, version, body size and checksum.
+constexpr size_t SUPERBLOCK_HEADER_SIZE = 4 + 4 + 4 + 8;
+
+static void write_name(std::ostream &stream, const std::string &name) {
+  if (name.empty() || name.size() > UINT8_MAX)
+    throw std::invalid_argument("Invalid index name '" + name + "'.");
+  Serializer::write_uint8(stream, name.size());
+  stream.write(name.data(), name.size());
+}
+
+static std::string read_name(std::istream &stream) {
+  std::string name(Serializer::read_uint8(stream), '\0');
+  stream.read(name.data(), name.size());
+  return name;
+}
+
+static Column read_column(std::istream &stream) {
+  auto column = (Column)Serializer::read_uint8(stream);
+  if (std::find(ALL_COLUMNS.begin(), ALL_COLUMNS.end(), column) ==
+      ALL_COLUMNS.end())
+    throw std::runtime_error("Unknown column in the superblock.");
+  return column;
+}
+
+void Superblock::encode(char *page) const {
+  std::ostringstream body;
+  Serializer::write_uint64(body, this->sequence);
+  Serializer::write_uint32(body, this->page_size);
+  Serializer::write_bool(body, this->columnar);
+  Serializer::write_uint32(body, this->record_count);
+  Serializer::write_uint32(body, this->data_block_count);
+  Serializer::write_uint32(body, this->index_block_count);
+  Serializer::write_uint32(body, this->overflow_block_count);
+  Serializer::write_uint32(body, this->hash_block_count);
+  Serializer::write_uint32(body, this->trees.size());
+  for (const auto &[name, tree] : this->trees) {
+    write_name(body, name);
+    Serializer::write_uint8(body, (uint8_t)tree.key_type);
+    Serializer::write_uint32(body, tree.degree);
+    Serializer::write_uint32(body, tree.root);
+    Serializer::write_uint32(body, tree.height);
+    Serializer::write_bool(body, tree.aggregated);
+    Serializer::write_uint8(body, tree.included.size());
+    for (auto column : tree.included)
+      Serializer::write_uint8(body, (uint8_t)column);
+  }
+  Serializer::write_uint32(body, this->hash_indexes.size());
+  for (const auto &[name, index] : this->hash_indexes) {
+    write_name(body, name);
+    Serializer::write_uint8(body, (uint8_t)index.column);
+    Serializer::write_uint32(body, index.directory);
+  }
+  auto encoded = body.str();
+  if (encoded.size() > SUPERBLOCK_SIZE - SUPERBLOCK_HEADER_SIZE)
+    throw std::runtime_error("The catalog does not fit in the superblock.");
+
+  std::ostringstream header;
+  Serializer::write_uint32(header, SUPERBLOCK_MAGIC);
+  Serializer::write_uint32(header, SUPERBLOCK_VERSION);
+  Serializer::write_uint32(header, encoded.size());
+  Serializer::write_uint64(
+      header, Serializer::checksum(encoded.data(), encoded.size()));
+  auto bytes = header.str() + encoded;
+  std::fill(page, page + SUPERBLOCK_SIZE, 0);
+  std::copy(bytes.begin(), bytes.end(), page);
+}
+
+std::optional<Superblock> Superblock::decode(const char *page) {
+  std::istringstream stream(std::string(page, SUPERBLOCK_SIZE));
+  auto magic = Serializer::read_uint32(stream);
+  auto version = Serializer::read_uint32(stream);
+  auto body_size = Serializer::read_uint32(stream);
+  auto expected = Serializer::read_uint64(stream);
+  if (magic != SUPERBLOCK_MAGIC ||
+      body_size > SUPERBLOCK_SIZE - SUPERBLOCK_HEADER_SIZE ||
+      Serializer::checksum(page + SUPERBLOCK_HEADER_SIZE, body_size) !=
+          expected)
+    return std::nullopt;
+  if (version != SUPERBLOCK_VERSION)
+    throw std::runtime_error("Unsupported superblock version " +
+                             std::to_string(version) + ".");
+
+  Superblock superblock;
+  superblock.sequence = Serializer::read_uint64(stream);
+  superblock.page_size = Serializer::read_uint32(stream);
+  superblock.columnar = Serializer::read_bool(stream);
+  superblock.record_count = Serializer::read_uint32(stream);
+  superblock.data_block_count = Serializer::read_uint32(stream);
+  superblock.index_block_count = Serializer::read_uint32(stream);
+  superblock.overflow_block_count = Serializer::read_uint32(stream);
+  superblock.hash_block_count = Serializer::read_uint32(stream);
+  auto tree_count = Serializer::read_uint32(stream);
+  for (uint32_t i = 0; i < tree_count && stream; ++i) {
+    auto name = read_name(stream);
+    TreeInfo tree;
+    tree.key_type = (KeyType)Serializer::read_uint8(stream);
+    if (tree.key_type > KeyType::TeamDate)
+      throw std::runtime_error("Unknown key type in the superblock.");
+    tree.degree = Serializer::read_uint32(stream);
+    tree.root = Serializer::read_uint32(stream);
+    tree.height = Serializer::read_uint32(stream);
+    tree.aggregated = Serializer::read_bool(stream);
+    auto included_count = Serializer::read_uint8(stream);
+    for (int j = 0; j < included_count; ++j)
+      tree.included.push_back(read_column(stream));
+    superblock.trees.emplace(name, tree);
+  }
+  auto hash_index_count = Serializer::read_uint32(stream);
+  for (uint32_t i = 0; i < hash_index_count && stream; ++i) {
+    auto name = read_name(stream);
+    HashIndexInfo index;
+    index.column = read_column(stream);
+    index.directory = Serializer::read_uint32(stream);
+    superblock.hash_indexes.emplace(name, index);
+  }
+  if (!stream)
+    throw std::runtime_error("Corrupted superblock.");
+  return superblock;
+}
@@ -0,0 +1,66 @@
+#ifndef SUPERBLOCK_H
+#define SUPERBLOCK_H
+
+#include "data_block.h"
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Size of each copy of the superblock, independent of the block size so that
+// it can be read before the block size is checked.
+constexpr size_t SUPERBLOCK_SIZE = 4096;
+
+// Key types of the trees we instantiate, so that a tree is never opened with
+// keys of another type.
+enum class KeyType : uint8_t {
+  Float = 0,
+  Uint32 = 1,
+  TeamDate = 2,
+};
+
+// What it takes to attach to a B+ tree again.
+struct TreeInfo {
+  KeyType key_type;
+  int degree;
+  // Block id of the root node.
+  int root;
+  int height;
+  bool aggregated;
+  std::vector<Column> included;
+};
+
+// What it takes to attach to a hash index again.
+struct HashIndexInfo {
+  Column column;
+  // First directory page.
+  int directory;
+};
+
+// Catalog of a Storage: the block counts and layout to open its files with,
+// and the indexes in them by name. The superblock file holds two copies,
+// written in turn and each with a checksum, so that a write torn by a crash
+// leaves the previous copy to open.
+struct Superblock {
+  // Incremented with every write, to tell the latest copy.
+  uint64_t sequence = 0;
+  int page_size = 0;
+  bool columnar = false;
+  int record_count = 0;
+  int data_block_count = 0;
+  int index_block_count = 0;
+  int overflow_block_count = 0;
+  int hash_block_count = 0;
+  std::map<std::string, TreeInfo> trees;
+  std::map<std::string, HashIndexInfo> hash_indexes;
+
+  // Lays the superblock out in a page of SUPERBLOCK_SIZE bytes. Throws if it
+  // does not fit.
+  void encode(char *page) const;
+  // Reads a page written by encode, or returns nothing if it is torn or was
+  // never written.
+  static std::optional<Superblock> decode(const char *page);
+};
+
+#endif // SUPERBLOCK_H
@@ -0,0 +1,255 @@
+#include "wal.h"
+#include "serialize.h"
+#include <assert.h>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Starts every batch, to tell a batch apart from garbage after a torn write.
+constexpr uint32_t BATCH_MAGIC = 0x57414C42;
+// Magic, sequence number, page count, body size and checksum.
+constexpr size_t BATCH_HEADER_SIZE = 4 + 8 + 4 + 4 + 8;
+
+#ifdef _WIN32
+
+LogFile::LogFile(const std::string &path) : m_path(path) {
+  m_handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+                         FILE_SHARE_READ, nullptr, OPEN_ALWAYS,
+                         FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (m_handle == INVALID_HANDLE_VALUE)
+    throw std::runtime_error("Error opening log " + path + ".");
+}
+
+LogFile::~LogFile() { CloseHandle(m_handle); }
+
+std::string LogFile::read_all() const {
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(m_handle, &size))
+    throw std::runtime_error("Error reading log " + m_path + ".");
+  std::string bytes(size.QuadPart, '\0');
+  OVERLAPPED overlapped{};
+  DWORD read = 0;
+  if (!bytes.empty() && (!ReadFile(m_handle, bytes.data(), (DWORD)bytes.size(),
+                                   &read, &overlapped) ||
+                         read != bytes.size()))
+    throw std::runtime_error("Error reading log " + m_path + ".");
+  return bytes;
+}
+
+void LogFile::append(const std::string &bytes) {
+  LARGE_INTEGER zero{};
+  DWORD written = 0;
+  if (!SetFilePointerEx(m_handle, zero, nullptr, FILE_END) ||
+      !WriteFile(m_handle, bytes.data(), (DWORD)bytes.size(), &written,
+                 nullptr) ||
+      written != bytes.size())
+    throw std::runtime_error("Error writing log " + m_path + ".");
+}
+
+void LogFile::sync() {
+  if (!FlushFileBuffers(m_handle))
+    throw std::runtime_error("Error syncing log " + m_path + ".");
+}
+
+void LogFile::truncate() {
+  LARGE_INTEGER zero{};
+  if (!SetFilePointerEx(m_handle, zero, nullptr, FILE_BEGIN) ||
+      !SetEndOfFile(m_handle))
+    throw std::runtime_error("Error truncating log " + m_path + ".");
+  this->sync();
+}
+
+#else
+
+LogFile::LogFile(const std::string &path) : m_path(path) {
+  m_fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (m_fd < 0)
+    throw std::runtime_error("Error opening log " + path + ".");
+}
+
+LogFile::~LogFile() { close(m_fd); }
+
+std::string LogFile::read_all() const {
+  struct stat info;
+  if (fstat(m_fd, &info) != 0)
+    throw std::runtime_error("Error reading log " + m_path + ".");
+  std::string bytes(info.st_size, '\0');
+  size_t done = 0;
+  while (done < bytes.size()) {
+    auto res = pread(m_fd, bytes.data() + done, bytes.size() - done, done);
+    if (res < 0 && errno == EINTR)
+      continue;
+    if (res <= 0)
+      throw std::runtime_error("Error reading log " + m_path + ".");
+    done += res;
+  }
+  return bytes;
+}
+
+void LogFile::append(const std::string &bytes) {
+  size_t done = 0;
+  while (done < bytes.size()) {
+    auto res = write(m_fd, bytes.data() + done, bytes.size() - done);
+    if (res < 0 && errno == EINTR)
+      continue;
+    if (res <= 0)
+      throw std::runtime_error("Error writing log " + m_path + ".");
+    done += res;
+  }
+}
+
+void LogFile::sync() {
+#ifdef __linux__
+  auto res = fdatasync(m_fd);
+#else
+  auto res = fsync(m_fd);
+#endif
+  if (res != 0)
+    throw std::runtime_error("Error syncing log " + m_path + ".");
+}
+
+void LogFile::truncate() {
+  if (ftruncate(m_fd, 0) != 0)
+    throw std::runtime_error("Error truncating log " + m_path + ".");
+  this->sync();
+}
+
+#endif
+
+WriteAheadLog::WriteAheadLog(const std::string &path, size_t page_size)
+    : m_file(path), m_page_size(page_size) {}
+
+size_t WriteAheadLog::replay(
+    const std::function<void(const PageImage &)> &apply) const {
+  auto bytes = this->m_file.read_all();
+  std::istringstream stream(bytes);
+  size_t batches = 0;
+  for (size_t offset = 0; offset + BATCH_HEADER_SIZE <= bytes.size();
+       ++batches) {
+    stream.seekg(offset);
+    auto magic = Serializer::read_uint32(stream);
+    Serializer::read_uint64(stream);
+    auto page_count = Serializer::read_uint32(stream);
+    auto body_size = Serializer::read_uint32(stream);
+    auto expected = Serializer::read_uint64(stream);
+    auto body = offset + BATCH_HEADER_SIZE;
+    // A torn batch can only be the last one written.
+    if (magic != BATCH_MAGIC || body_size > bytes.size() - body ||
+        body_size != page_count * (1 + 4 + this->m_page_size) ||
+        Serializer::checksum(bytes.data() + body, body_size) != expected)
+      break;
+    PageImage image;
+    image.page.resize(this->m_page_size);
+    for (uint32_t i = 0; i < page_count; ++i) {
+      image.kind = (LogFileKind)Serializer::read_uint8(stream);
+      image.block_id = Serializer::read_uint32(stream);
+      stream.read(image.page.data(), this->m_page_size);
+      apply(image);
+    }
+    offset = body + body_size;
+  }
+  return batches;
+}
+
+uint64_t WriteAheadLog::append(const std::vector<PageImage> &pages) {
+  std::ostringstream body;
+  for (const auto &image : pages) {
+    if (image.page.size() != this->m_page_size)
+      throw std::invalid_argument("Page image has the wrong size.");
+    Serializer::write_uint8(body, (uint8_t)image.kind);
+    Serializer::write_uint32(body, image.block_id);
+    body.write(image.page.data(), image.page.size());
+  }
+  auto encoded = body.str();
+
+  std::lock_guard<std::mutex> guard(this->m_latch);
+  if (this->m_error)
+    std::rethrow_exception(this->m_error);
+  auto lsn = ++this->m_appended_lsn;
+  std::ostringstream header;
+  Serializer::write_uint32(header, BATCH_MAGIC);
+  Serializer::write_uint64(header, lsn);
+  Serializer::write_uint32(header, pages.size());
+  Serializer::write_uint32(header, encoded.size());
+  Serializer::write_uint64(
+      header, Serializer::checksum(encoded.data(), encoded.size()));
+  this->m_pending += header.str();
+  this->m_pending += encoded;
+  ++this->m_stats.batches;
+  return lsn;
+}
+
+void WriteAheadLog::flush(uint64_t lsn) {
+  std::unique_lock<std::mutex> lock(this->m_latch);
+  assert(lsn <= this->m_appended_lsn);
+  while (this->m_durable_lsn < lsn) {
+    if (this->m_error)
+      std::rethrow_exception(this->m_error);
+    if (this->m_flushing) {
+      this->m_flushed.wait(lock);
+      continue;
+    }
+    // Write everything queued so far, for every thread waiting on it.
+    this->m_flushing = true;
+    auto bytes = std::move(this->m_pending);
+    this->m_pending.clear();
+    auto target = this->m_appended_lsn;
+    lock.unlock();
+    try {
+      this->m_file.append(bytes);
+      this->m_file.sync();
+    } catch (...) {
+      lock.lock();
+      this->m_error = std::current_exception();
+      this->m_flushing = false;
+      this->m_flushed.notify_all();
+      throw;
+    }
+    lock.lock();
+    this->m_flushing = false;
+    this->m_durable_lsn = target;
+    this->m_size += bytes.size();
+    ++this->m_stats.syncs;
+    this->m_stats.bytes += bytes.size();
+    this->m_flushed.notify_all();
+  }
+}
+
+uint64_t WriteAheadLog::last_lsn() const {
+  std::lock_guard<std::mutex> guard(this->m_latch);
+  return this->m_appended_lsn;
+}
+
+uint64_t WriteAheadLog::durable_lsn() const {
+  std::lock_guard<std::mutex> guard(this->m_latch);
+  return this->m_durable_lsn;
+}
+
+void WriteAheadLog::truncate() {
+  std::unique_lock<std::mutex> lock(this->m_latch);
+  this->m_flushed.wait(lock, [this] { return !this->m_flushing; });
+  if (this->m_error)
+    std::rethrow_exception(this->m_error);
+  if (!this->m_pending.empty())
+    throw std::logic_error("Cannot truncate a log with batches not flushed.");
+  this->m_file.truncate();
+  this->m_size = 0;
+}
+
+uint64_t WriteAheadLog::size() const {
+  std::lock_guard<std::mutex> guard(this->m_latch);
+  return this->m_size;
+}
+
+LogStats WriteAheadLog::stats() const {
+  std::lock_guard<std::mutex> guard(this->m_latch);
+  return this->m_stats;
+}
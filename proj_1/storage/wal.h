@@ -0,0 +1,115 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Files of a Storage whose pages are logged.
+enum class LogFileKind : uint8_t {
+  Data = 0,
+  Index = 1,
+  Overflow = 2,
+  Hash = 3,
+  // The catalog, whose image holds the roots of the trees.
+  Superblock = 4,
+};
+
+// Image of a page after a change, as it is to be written to its file.
+struct PageImage {
+  LogFileKind kind;
+  int block_id;
+  std::vector<char> page;
+};
+
+// Append-only file the log is written to, synced to disk on request.
+class LogFile {
+public:
+  explicit LogFile(const std::string &path);
+  ~LogFile();
+
+  LogFile(const LogFile &) = delete;
+  LogFile &operator=(const LogFile &) = delete;
+
+  // Returns the whole contents of the file.
+  std::string read_all() const;
+  void append(const std::string &bytes);
+  void sync();
+  void truncate();
+
+private:
+  std::string m_path;
+#ifdef _WIN32
+  void *m_handle;
+#else
+  int m_fd;
+#endif
+};
+
+struct LogStats {
+  // Batches of page images appended, and the syncs that made them durable.
+  size_t batches = 0;
+  size_t syncs = 0;
+  size_t bytes = 0;
+};
+
+// Redo log of page images. Each batch holds the images of every page changed
+// since the previous one, taken between operations, so replaying a batch
+// brings its pages to a state where every operation before it is complete.
+// Batches are framed with their length and a checksum, so a batch torn by a
+// crash is detected and ends the replay.
+//
+// Commits use group commit: append only queues a batch in memory, and flush
+// writes everything queued so far with a single sync. Threads flushing while
+// a sync is under way wait for it, and the next of them to find their batch
+// still not durable syncs for all of those that arrived in the meantime.
+//
+// A failed write or sync leaves the file in an unknown state and the batches
+// it held lost, so the log then refuses every append, flush and truncate
+// with the same error.
+class WriteAheadLog {
+public:
+  WriteAheadLog(const std::string &path, size_t page_size);
+
+  // Calls apply with every page image of the complete batches in the file,
+  // oldest first. Returns the number of batches.
+  size_t replay(const std::function<void(const PageImage &)> &apply) const;
+
+  // Queues a batch, returning its log sequence number.
+  uint64_t append(const std::vector<PageImage> &pages);
+  // Returns once the batch with the given sequence number, and every one
+  // before it, is on disk.
+  void flush(uint64_t lsn);
+  // Number of the last batch appended, or 0.
+  uint64_t last_lsn() const;
+  // Number of the last batch on disk, or 0.
+  uint64_t durable_lsn() const;
+  // Empties the log, once every page it holds is written in place and synced.
+  // Sequence numbers continue from where they were.
+  void truncate();
+  // Bytes written to the file since it was opened or last emptied.
+  uint64_t size() const;
+
+  LogStats stats() const;
+
+private:
+  LogFile m_file;
+  size_t m_page_size;
+  mutable std::mutex m_latch;
+  std::condition_variable m_flushed;
+  // Encoded batches not yet written.
+  std::string m_pending;
+  uint64_t m_appended_lsn = 0;
+  uint64_t m_durable_lsn = 0;
+  uint64_t m_size = 0;
+  bool m_flushing = false;
+  // Error of the write or sync that failed, if one did.
+  std::exception_ptr m_error;
+  LogStats m_stats;
+};
+
+#endif // WAL_H
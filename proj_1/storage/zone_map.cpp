@@ -0,0 +1,116 @@
+#include "zone_map.h"
+#include "serialize.h"
+#include <algorithm>
+#include <assert.h>
+#include <stdexcept>
+
+double column_value(const Record &record, Column column) {
+  switch (column) {
+  case Column::GameDateEst:
+    return record.game_date_est;
+  case Column::TeamIdHome:
+    return record.team_id_home;
+  case Column::FgPctHome:
+    return record.fg_pct_home;
+  case Column::FtPctHome:
+    return record.ft_pct_home;
+  case Column::Fg3PctHome:
+    return record.fg3_pct_home;
+  case Column::AstHome:
+    return record.ast_home;
+  case Column::RebHome:
+    return record.reb_home;
+  case Column::PtsHome:
+    return record.pts_home;
+  case Column::HomeTeamWins:
+    return record.home_team_wins;
+  }
+  throw std::invalid_argument("Unknown column.");
+}
+
+static size_t column_index(Column column) {
+  auto it = std::find(ALL_COLUMNS.begin(), ALL_COLUMNS.end(), column);
+  if (it == ALL_COLUMNS.end())
+    throw std::invalid_argument("Unknown column.");
+  return it - ALL_COLUMNS.begin();
+}
+
+void BlockZone::add(const Record &record) {
+  ++this->record_count;
+  for (size_t i = 0; i < ALL_COLUMNS.size(); ++i) {
+    auto value = column_value(record, ALL_COLUMNS[i]);
+    this->columns[i].min = std::min(this->columns[i].min, value);
+    this->columns[i].max = std::max(this->columns[i].max, value);
+  }
+}
+
+const BlockZone::Bounds &BlockZone::bounds(Column column) const {
+  return this->columns[column_index(column)];
+}
+
+bool BlockZone::may_match(Column column, double lo, double hi) const {
+  if (this->record_count == 0)
+    return true;
+  const auto &bounds = this->bounds(column);
+  return bounds.max >= lo && bounds.min <= hi;
+}
+
+// Serialized as the zone count and column count, then per zone the record
+// count and each column's min and max.
+ZoneMap::ZoneMap(std::istream &stream) {
+  auto zone_count = Serializer::read_uint32(stream);
+  auto column_count = Serializer::read_uint32(stream);
+  if (!stream || column_count != ALL_COLUMNS.size())
+    throw std::runtime_error("Zone map does not match the record columns.");
+  this->m_zones.resize(zone_count);
+  for (auto &zone : this->m_zones) {
+    zone.record_count = Serializer::read_uint32(stream);
+    for (auto &bounds : zone.columns) {
+      bounds.min = Serializer::read_double(stream);
+      bounds.max = Serializer::read_double(stream);
+    }
+  }
+  if (!stream)
+    throw std::runtime_error("Zone map is truncated.");
+}
+
+void ZoneMap::write(std::ostream &stream) const {
+  Serializer::write_uint32(stream, this->m_zones.size());
+  Serializer::write_uint32(stream, ALL_COLUMNS.size());
+  for (const auto &zone : this->m_zones) {
+    Serializer::write_uint32(stream, zone.record_count);
+    for (const auto &bounds : zone.columns) {
+      Serializer::write_double(stream, bounds.min);
+      Serializer::write_double(stream, bounds.max);
+    }
+  }
+}
+
+const BlockZone &ZoneMap::zone(int block_id) const {
+  assert(block_id >= 0 && (size_t)block_id < this->m_zones.size());
+  return this->m_zones[block_id];
+}
+
+void ZoneMap::set_zone(int block_id, const BlockZone &zone) {
+  assert(block_id >= 0);
+  if ((size_t)block_id >= this->m_zones.size())
+    this->m_zones.resize(block_id + 1);
+  this->m_zones[block_id] = zone;
+}
+
+bool ZoneMap::may_match(int block_id, Column column, double lo,
+                        double hi) const {
+  if (block_id < 0 || (size_t)block_id >= this->m_zones.size())
+    return true;
+  return this->m_zones[block_id].may_match(column, lo, hi);
+}
+
+std::vector<int> ZoneMap::matching_blocks(int block_count, Column column,
+                                          double lo, double hi) const {
+  std::vector<int> ids;
+  ids.reserve(block_count);
+  for (int id = 0; id < block_count; ++id)
+    if (this->may_match(id, column, lo, hi))
+      ids.push_back(id);
+  return ids;
+}
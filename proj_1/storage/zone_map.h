@@ -0,0 +1,66 @@
+#ifndef ZONE_MAP_H
+#define ZONE_MAP_H
+
+#include "data_block.h"
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+// Every column of a record, in serialized order.
+constexpr std::array<Column, 9> ALL_COLUMNS{
+    Column::GameDateEst, Column::TeamIdHome, Column::FgPctHome,
+    Column::FtPctHome,   Column::Fg3PctHome, Column::AstHome,
+    Column::RebHome,     Column::PtsHome,    Column::HomeTeamWins,
+};
+
+// Value of a record's column, widened so every column compares alike.
+double column_value(const Record &record, Column column);
+
+// Summary of the records in one data block. The columns cannot be null, so
+// only the record count is kept besides each column's bounds.
+struct BlockZone {
+  struct Bounds {
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+  };
+
+  uint32_t record_count = 0;
+  std::array<Bounds, ALL_COLUMNS.size()> columns{};
+
+  void add(const Record &record);
+  const Bounds &bounds(Column column) const;
+  // Whether a record of the block may have column within [lo, hi].
+  bool may_match(Column column, double lo, double hi) const;
+};
+
+// Zones of the data blocks, by block id, so that scans with a range predicate
+// skip the blocks that cannot match without reading them.
+class ZoneMap {
+public:
+  ZoneMap() {};
+  // Reads a zone map written by write. Throws if it is malformed.
+  explicit ZoneMap(std::istream &stream);
+
+  void write(std::ostream &stream) const;
+
+  size_t block_count() const { return this->m_zones.size(); };
+  const BlockZone &zone(int block_id) const;
+  // Sets the zone of a block, growing the map as needed.
+  void set_zone(int block_id, const BlockZone &zone);
+  void clear() { this->m_zones.clear(); };
+
+  // Whether block may hold a record with column within [lo, hi]. Blocks
+  // without a zone always may.
+  bool may_match(int block_id, Column column, double lo, double hi) const;
+  // The blocks among the first block_count that may match, in order.
+  std::vector<int> matching_blocks(int block_count, Column column, double lo,
+                                   double hi) const;
+
+private:
+  // Zones never set are empty, and empty zones are never pruned.
+  std::vector<BlockZone> m_zones;
+};
+
+#endif // ZONE_MAP_H
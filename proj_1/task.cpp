@@ -1,14 +1,17 @@
 #include "bp_tree.h"
+#include "hash_index.h"
+#include "parallel.h"
+#include "scan_kernel.h"
 #include "storage/data_block.h"
 #include <assert.h>
 #include <iomanip>
 
 void task_1(Storage *storage) {
-  int records_per_block = DataBlock::max_records(storage->block_size);
+  int records_per_block = storage->records_per_data_block();
   int record_count = 0;
 
-  for (auto i = 0; i < storage->loaded_data_block_count(); ++i) {
-    record_count += storage->get_data_block(i)->records.size();
+  for (auto i = 0; i < storage->data_block_count(); ++i) {
+    record_count += storage->get_data_block_view(i).size();
   }
 
   std::cout << "Record size: " << Record::size() << " bytes ("
@@ -17,11 +20,11 @@ void task_1(Storage *storage) {
   std::cout << "Number of Records: " << record_count << std::endl;
   std::cout << "Number of Records per Block: " << records_per_block
             << std::endl;
-  std::cout << "Number of Data Blocks: " << storage->loaded_data_block_count()
+  std::cout << "Number of Data Blocks: " << storage->data_block_count()
             << std::endl;
 }
 
-void task_2(BPlusTree *tree) {
+void task_2(BPlusTree<float> *tree) {
   std::cout << "Parameter N: " << tree->get_degree() << std::endl;
   std::cout << "Number of nodes: " << tree->get_number_of_nodes() << std::endl;
   std::cout << "Number of levels: " << tree->get_height() << std::endl;
@@ -37,6 +40,9 @@ void task_2(BPlusTree *tree) {
   std::cout << "]" << std::endl;
 };
 
+// Data blocks per unit of work in the parallel scan.
+constexpr size_t SCAN_MORSEL_BLOCKS = 8;
+
 struct Task3Stats {
   double time_taken = 0;
   int num_results = 0;
@@ -44,18 +50,31 @@ struct Task3Stats {
 
   size_t index_block_count = 0;
   size_t data_block_count = 0;
+  // Data block reads including repeated reads of the same block.
+  size_t data_block_fetches = 0;
+  // Data blocks skipped without reading, as their zone cannot match.
+  size_t blocks_pruned = 0;
 };
 
 Task3Stats do_bruteforce_scan(Storage *storage, int block_count);
-Task3Stats do_bp_tree(BPlusTree *tree);
+Task3Stats do_parallel_scan(Storage *storage, int block_count);
+Task3Stats do_bp_tree(BPlusTree<float> *tree);
+Task3Stats do_bp_tree_in_block_order(BPlusTree<float> *tree);
+Task3Stats do_bp_tree_index_only(BPlusTree<float> *tree);
+Task3Stats do_bp_tree_aggregate(BPlusTree<float> *tree);
 
-void task_3(BPlusTree *tree, Storage *storage, int block_count) {
+void task_3(BPlusTree<float> *tree, Storage *storage, int block_count) {
   std::cout << "Task 3: Index Scan vs Brute-Force Linear Scan ('FG_PCT_HOME' "
                "from 0.6 to 0.9, inclusively)"
             << std::endl;
-  double bruteforce_time{0}, bp_tree_time{0};
+  double bruteforce_time{0}, bp_tree_time{0}, block_order_time{0},
+      index_only_time{0}, aggregate_time{0}, parallel_time{0};
   auto bruteforce_results = do_bruteforce_scan(storage, block_count);
   auto bp_tree_results = do_bp_tree(tree);
+  auto block_order_results = do_bp_tree_in_block_order(tree);
+  auto index_only_results = do_bp_tree_index_only(tree);
+  auto aggregate_results = do_bp_tree_aggregate(tree);
+  auto parallel_results = do_parallel_scan(storage, block_count);
   // For time, we do it 1000 times or 30 seconds, whichever comes first, just
   // for good measure.
   int iteration_count = 0;
@@ -63,9 +82,19 @@ void task_3(BPlusTree *tree, Storage *storage, int block_count) {
     ++iteration_count;
     auto bruteforce_time_trial = do_bruteforce_scan(storage, block_count);
     auto bp_tree_time_trial = do_bp_tree(tree);
+    auto block_order_time_trial = do_bp_tree_in_block_order(tree);
+    auto index_only_time_trial = do_bp_tree_index_only(tree);
+    auto aggregate_time_trial = do_bp_tree_aggregate(tree);
+    auto parallel_time_trial = do_parallel_scan(storage, block_count);
     bruteforce_time += bruteforce_time_trial.time_taken;
     bp_tree_time += bp_tree_time_trial.time_taken;
-    if (bruteforce_time + bp_tree_time > 30) {
+    block_order_time += block_order_time_trial.time_taken;
+    index_only_time += index_only_time_trial.time_taken;
+    aggregate_time += aggregate_time_trial.time_taken;
+    parallel_time += parallel_time_trial.time_taken;
+    if (bruteforce_time + bp_tree_time + block_order_time + index_only_time +
+            aggregate_time + parallel_time >
+        30) {
       break;
     }
   }
@@ -75,31 +104,73 @@ void task_3(BPlusTree *tree, Storage *storage, int block_count) {
 
   std::cout << std::setw(16) << "";
   std::cout << std::setw(12) << "Brute-Force";
-  std::cout << std::setw(12) << "B+ Tree" << std::endl;
+  std::cout << std::setw(12) << "B+ Tree";
+  std::cout << std::setw(12) << "Block Order";
+  std::cout << std::setw(12) << "Index Only";
+  std::cout << std::setw(12) << "Aggregate";
+  std::cout << std::setw(12) << "Parallel" << std::endl;
 
   std::cout << std::setw(16) << "Time Taken (s)";
   std::cout << std::setw(12) << bruteforce_time;
   std::cout << std::setw(12) << bp_tree_time;
+  std::cout << std::setw(12) << block_order_time;
+  std::cout << std::setw(12) << index_only_time;
+  std::cout << std::setw(12) << aggregate_time;
+  std::cout << std::setw(12) << parallel_time;
   std::cout << " (" << iteration_count << " iterations)" << std::endl;
 
   std::cout << std::setw(16) << "Rows Matched";
   std::cout << std::setw(12) << bruteforce_results.num_results;
   std::cout << std::setw(12) << bp_tree_results.num_results;
+  std::cout << std::setw(12) << block_order_results.num_results;
+  std::cout << std::setw(12) << index_only_results.num_results;
+  std::cout << std::setw(12) << aggregate_results.num_results;
+  std::cout << std::setw(12) << parallel_results.num_results;
   std::cout << std::endl;
 
   std::cout << std::setw(16) << "Avg FG_PCT_HOME";
   std::cout << std::setw(12) << bruteforce_results.average;
   std::cout << std::setw(12) << bp_tree_results.average;
+  std::cout << std::setw(12) << block_order_results.average;
+  std::cout << std::setw(12) << index_only_results.average;
+  std::cout << std::setw(12) << aggregate_results.average;
+  std::cout << std::setw(12) << parallel_results.average;
   std::cout << std::endl;
 
   std::cout << std::setw(16) << "Index Access";
   std::cout << std::setw(12) << bruteforce_results.index_block_count;
   std::cout << std::setw(12) << bp_tree_results.index_block_count;
+  std::cout << std::setw(12) << block_order_results.index_block_count;
+  std::cout << std::setw(12) << index_only_results.index_block_count;
+  std::cout << std::setw(12) << aggregate_results.index_block_count;
+  std::cout << std::setw(12) << parallel_results.index_block_count;
   std::cout << std::endl;
 
   std::cout << std::setw(16) << "Data Access";
   std::cout << std::setw(12) << bruteforce_results.data_block_count;
   std::cout << std::setw(12) << bp_tree_results.data_block_count;
+  std::cout << std::setw(12) << block_order_results.data_block_count;
+  std::cout << std::setw(12) << index_only_results.data_block_count;
+  std::cout << std::setw(12) << aggregate_results.data_block_count;
+  std::cout << std::setw(12) << parallel_results.data_block_count;
+  std::cout << std::endl;
+
+  std::cout << std::setw(16) << "Data Fetches";
+  std::cout << std::setw(12) << bruteforce_results.data_block_fetches;
+  std::cout << std::setw(12) << bp_tree_results.data_block_fetches;
+  std::cout << std::setw(12) << block_order_results.data_block_fetches;
+  std::cout << std::setw(12) << index_only_results.data_block_fetches;
+  std::cout << std::setw(12) << aggregate_results.data_block_fetches;
+  std::cout << std::setw(12) << parallel_results.data_block_fetches;
+  std::cout << std::endl;
+
+  std::cout << std::setw(16) << "Blocks Pruned";
+  std::cout << std::setw(12) << bruteforce_results.blocks_pruned;
+  std::cout << std::setw(12) << bp_tree_results.blocks_pruned;
+  std::cout << std::setw(12) << block_order_results.blocks_pruned;
+  std::cout << std::setw(12) << index_only_results.blocks_pruned;
+  std::cout << std::setw(12) << aggregate_results.blocks_pruned;
+  std::cout << std::setw(12) << parallel_results.blocks_pruned;
   std::cout << std::endl;
 
   std::cout << std::endl;
@@ -109,22 +180,105 @@ void task_3(BPlusTree *tree, Storage *storage, int block_count) {
 // Actual implementation for task 3.
 
 Task3Stats do_bruteforce_scan(Storage *storage, int block_count) {
+  RangeAggregate aggregate;
+
+  storage->flush_cache_without_writing();
+  storage->reset_stats();
+  auto start_time = std::chrono::high_resolution_clock::now();
+
+  // Blocks whose zone lies outside the range are neither read nor read ahead.
+  auto blocks = storage->zone_map().matching_blocks(
+      block_count, Column::FgPctHome, 0.6, 0.9);
+  std::vector<float> buffer;
+  for (size_t i = 0; i < blocks.size(); i++) {
+    storage->read_ahead_data_blocks(blocks, i);
+    auto b = storage->get_data_block_view(blocks[i]);
+    // Only the one column is read, in place for columnar blocks.
+    auto values = b.column(Column::FgPctHome, buffer);
+    aggregate.merge(aggregate_range(values, b.size(), 0.6, 0.9));
+  }
+  auto end_time = std::chrono::high_resolution_clock::now(); // End time
+  std::chrono::duration<double> time_taken = end_time - start_time;
+
+  assert(aggregate.count > 0);
+  assert(aggregate.min >= 0.6 && aggregate.max <= 0.9);
+
+  return Task3Stats{
+      .time_taken = time_taken.count(),
+      .num_results = (int)aggregate.count,
+      .average = (float)aggregate.average(),
+      .index_block_count = storage->index_block_stats().misses,
+      .data_block_count = storage->data_block_stats().misses,
+      .data_block_fetches = storage->data_block_stats().hits +
+                            storage->data_block_stats().misses,
+      .blocks_pruned = block_count - blocks.size(),
+  };
+}
+
+Task3Stats do_parallel_scan(Storage *storage, int block_count) {
+  storage->flush_cache_without_writing();
+  storage->reset_stats();
+  auto start_time = std::chrono::high_resolution_clock::now();
+
+  // Each thread aggregates the morsels it processes, including stolen ones,
+  // and the partial aggregates are merged at the end.
+  auto blocks = storage->zone_map().matching_blocks(
+      block_count, Column::FgPctHome, 0.6, 0.9);
+  auto thread_count = default_thread_count();
+  std::vector<RangeAggregate> partials(thread_count);
+  parallel_morsels(
+      blocks.size(), SCAN_MORSEL_BLOCKS, thread_count,
+      [&](int thread, size_t begin, size_t end) {
+        std::vector<float> buffer;
+        for (auto i = begin; i < end; ++i) {
+          storage->read_ahead_data_blocks(blocks, i);
+          auto b = storage->get_data_block_view(blocks[i]);
+          auto values = b.column(Column::FgPctHome, buffer);
+          partials[thread].merge(aggregate_range(values, b.size(), 0.6, 0.9));
+        }
+      });
+  RangeAggregate aggregate;
+  for (const auto &partial : partials)
+    aggregate.merge(partial);
+  auto end_time = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<double> time_taken = end_time - start_time;
+
+  assert(aggregate.count > 0);
+
+  return Task3Stats{
+      .time_taken = time_taken.count(),
+      .num_results = (int)aggregate.count,
+      .average = (float)aggregate.average(),
+      .index_block_count = storage->index_block_stats().misses,
+      .data_block_count = storage->data_block_stats().misses,
+      .data_block_fetches = storage->data_block_stats().hits +
+                            storage->data_block_stats().misses,
+      .blocks_pruned = block_count - blocks.size(),
+  };
+}
+
+Task3Stats do_bp_tree(BPlusTree<float> *tree) {
   float sum = 0;
   int num_results = 0;
 
-  storage->flush_cache_without_writing();
+  tree->storage->flush_cache_without_writing();
+  tree->storage->reset_stats();
   auto start_time = std::chrono::high_resolution_clock::now();
 
-  for (int i = 0; i < block_count; i++) {
-    DataBlock *b = storage->get_data_block(i);
-    for (Record record : b->records) {
-      if (record.fg_pct_home >= 0.6 && record.fg_pct_home <= 0.9) {
-        sum += record.fg_pct_home;
-        num_results++;
-      }
+  auto scan = tree->scan(0.6, 0.9);
+  std::vector<RecordPointer> batch;
+  DataBlockView block;
+  while (scan.next(batch)) {
+    for (auto record : batch) {
+      if (block.id() != record.block_id)
+        block = tree->storage->get_data_block_view(record.block_id);
+      auto fg_pct_home = block.fg_pct_home(record.offset);
+      assert(fg_pct_home >= 0.6 && fg_pct_home <= 0.9);
+      sum += fg_pct_home;
+      ++num_results;
     }
   }
-  auto end_time = std::chrono::high_resolution_clock::now(); // End time
+  auto end_time = std::chrono::high_resolution_clock::now();
   std::chrono::duration<double> time_taken = end_time - start_time;
 
   assert(num_results > 0);
@@ -134,23 +288,28 @@ Task3Stats do_bruteforce_scan(Storage *storage, int block_count) {
       .time_taken = time_taken.count(),
       .num_results = num_results,
       .average = avg,
-      .index_block_count = storage->loaded_index_block_count(),
-      .data_block_count = storage->loaded_data_block_count(),
+      .index_block_count = tree->storage->index_block_stats().misses,
+      .data_block_count = tree->storage->data_block_stats().misses,
+      .data_block_fetches = tree->storage->data_block_stats().hits +
+                            tree->storage->data_block_stats().misses,
   };
 }
 
-Task3Stats do_bp_tree(BPlusTree *tree) {
+Task3Stats do_bp_tree_in_block_order(BPlusTree<float> *tree) {
   float sum = 0;
   int num_results = 0;
 
   tree->storage->flush_cache_without_writing();
+  tree->storage->reset_stats();
   auto start_time = std::chrono::high_resolution_clock::now();
 
-  for (auto it = tree->search(0.6); it != tree->end(); ++it) {
-    assert(it->fg_pct_home >= 0.6);
-    if (it->fg_pct_home > 0.9)
-      break;
-    sum += it->fg_pct_home;
+  DataBlockView block;
+  for (auto record : tree->scan_in_block_order(0.6, 0.9)) {
+    if (block.id() != record.block_id)
+      block = tree->storage->get_data_block_view(record.block_id);
+    auto fg_pct_home = block.fg_pct_home(record.offset);
+    assert(fg_pct_home >= 0.6 && fg_pct_home <= 0.9);
+    sum += fg_pct_home;
     ++num_results;
   }
   auto end_time = std::chrono::high_resolution_clock::now();
@@ -163,7 +322,175 @@ Task3Stats do_bp_tree(BPlusTree *tree) {
       .time_taken = time_taken.count(),
       .num_results = num_results,
       .average = avg,
-      .index_block_count = tree->storage->loaded_index_block_count(),
-      .data_block_count = tree->storage->loaded_data_block_count(),
+      .index_block_count = tree->storage->index_block_stats().misses,
+      .data_block_count = tree->storage->data_block_stats().misses,
+      .data_block_fetches = tree->storage->data_block_stats().hits +
+                            tree->storage->data_block_stats().misses,
+  };
+}
+
+// Answers the query from the leaves alone, as the index covers it: the only
+// column read is the key.
+Task3Stats do_bp_tree_index_only(BPlusTree<float> *tree) {
+  float sum = 0;
+  int num_results = 0;
+
+  tree->storage->flush_cache_without_writing();
+  tree->storage->reset_stats();
+  auto start_time = std::chrono::high_resolution_clock::now();
+
+  auto scan = tree->scan(0.6, 0.9);
+  CoveredBatch<float> batch;
+  while (scan.next(batch)) {
+    for (auto fg_pct_home : batch.keys) {
+      assert(fg_pct_home >= 0.6 && fg_pct_home <= 0.9);
+      sum += fg_pct_home;
+    }
+    num_results += batch.size();
+  }
+  auto end_time = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<double> time_taken = end_time - start_time;
+
+  assert(num_results > 0);
+  float avg = sum / num_results;
+
+  return Task3Stats{
+      .time_taken = time_taken.count(),
+      .num_results = num_results,
+      .average = avg,
+      .index_block_count = tree->storage->index_block_stats().misses,
+      .data_block_count = tree->storage->data_block_stats().misses,
+      .data_block_fetches = tree->storage->data_block_stats().hits +
+                            tree->storage->data_block_stats().misses,
+  };
+}
+
+// Answers the query from the aggregates kept in the internal nodes, reading
+// only the nodes on the paths to the bounds of the range.
+Task3Stats do_bp_tree_aggregate(BPlusTree<float> *tree) {
+  tree->storage->flush_cache_without_writing();
+  tree->storage->reset_stats();
+  auto start_time = std::chrono::high_resolution_clock::now();
+
+  auto aggregate = tree->range_aggregate(0.6, 0.9);
+  auto end_time = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<double> time_taken = end_time - start_time;
+
+  assert(aggregate.count > 0);
+  assert(aggregate.min >= 0.6f && aggregate.max <= 0.9f);
+
+  return Task3Stats{
+      .time_taken = time_taken.count(),
+      .num_results = (int)aggregate.count,
+      .average = (float)aggregate.average(),
+      .index_block_count = tree->storage->index_block_stats().misses,
+      .data_block_count = tree->storage->data_block_stats().misses,
+      .data_block_fetches = tree->storage->data_block_stats().hits +
+                            tree->storage->data_block_stats().misses,
+  };
+}
+
+Task3Stats do_bruteforce_lookup(Storage *storage, int block_count,
+                                Column column, uint32_t key) {
+  storage->flush_cache_without_writing();
+  storage->reset_stats();
+  auto start_time = std::chrono::high_resolution_clock::now();
+
+  int num_results = 0;
+  std::vector<uint32_t> buffer;
+  for (int i = 0; i < block_count; i++) {
+    if (!storage->zone_map().may_match(i, column, key, key))
+      continue;
+    storage->read_ahead_data_blocks(i);
+    auto b = storage->get_data_block_view(i);
+    auto values = b.column(column, buffer);
+    num_results += std::count(values, values + b.size(), key);
+  }
+  auto end_time = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<double> time_taken = end_time - start_time;
+
+  return Task3Stats{
+      .time_taken = time_taken.count(),
+      .num_results = num_results,
+      .data_block_count = storage->data_block_stats().misses,
+      .data_block_fetches = storage->data_block_stats().hits +
+                            storage->data_block_stats().misses,
+  };
+}
+
+// Reads every matching record, as a query fetching whole rows would.
+Task3Stats do_hash_lookup(HashIndex *index, Storage *storage, uint32_t key) {
+  storage->flush_cache_without_writing();
+  storage->reset_stats();
+  auto start_time = std::chrono::high_resolution_clock::now();
+
+  int num_results = 0;
+  DataBlockView block;
+  for (auto record : index->lookup(key)) {
+    if (block.id() != record.block_id)
+      block = storage->get_data_block_view(record.block_id);
+    assert((index->column() == Column::TeamIdHome
+                ? block.team_id_home(record.offset)
+                : block.game_date_est(record.offset)) == key);
+    ++num_results;
+  }
+  auto end_time = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<double> time_taken = end_time - start_time;
+
+  return Task3Stats{
+      .time_taken = time_taken.count(),
+      .num_results = num_results,
+      // Keys with many records go on in overflow pages.
+      .index_block_count = storage->hash_block_stats().misses +
+                           storage->overflow_block_stats().misses,
+      .data_block_count = storage->data_block_stats().misses,
+      .data_block_fetches = storage->data_block_stats().hits +
+                            storage->data_block_stats().misses,
   };
 }
+
+void point_lookups(HashIndex *index, Storage *storage, int block_count,
+                   uint32_t key) {
+  std::cout << "Point Lookup: Hash Index vs Brute-Force Linear Scan ("
+            << (index->column() == Column::TeamIdHome ? "'TEAM_ID_HOME'"
+                                                      : "'GAME_DATE_EST'")
+            << " = " << key << ")" << std::endl;
+  auto bruteforce_results =
+      do_bruteforce_lookup(storage, block_count, index->column(), key);
+  auto hash_results = do_hash_lookup(index, storage, key);
+  double bruteforce_time{0}, hash_time{0};
+  int iteration_count = 0;
+  while (iteration_count < 100 && bruteforce_time + hash_time < 10) {
+    ++iteration_count;
+    bruteforce_time +=
+        do_bruteforce_lookup(storage, block_count, index->column(), key)
+            .time_taken;
+    hash_time += do_hash_lookup(index, storage, key).time_taken;
+  }
+  assert(bruteforce_results.num_results == hash_results.num_results);
+
+  std::cout << std::setiosflags(std::ios::right);
+  std::cout << std::setw(16) << "";
+  std::cout << std::setw(12) << "Brute-Force";
+  std::cout << std::setw(12) << "Hash Index" << std::endl;
+
+  std::cout << std::setw(16) << "Time Taken (s)";
+  std::cout << std::setw(12) << bruteforce_time;
+  std::cout << std::setw(12) << hash_time;
+  std::cout << " (" << iteration_count << " iterations)" << std::endl;
+
+  std::cout << std::setw(16) << "Rows Matched";
+  std::cout << std::setw(12) << bruteforce_results.num_results;
+  std::cout << std::setw(12) << hash_results.num_results << std::endl;
+
+  std::cout << std::setw(16) << "Index Access";
+  std::cout << std::setw(12) << bruteforce_results.index_block_count;
+  std::cout << std::setw(12) << hash_results.index_block_count << std::endl;
+
+  std::cout << std::setw(16) << "Data Access";
+  std::cout << std::setw(12) << bruteforce_results.data_block_count;
+  std::cout << std::setw(12) << hash_results.data_block_count << std::endl;
+
+  std::cout << std::endl;
+  std::cout << std::resetiosflags(std::ios::right);
+}
@@ -2,9 +2,14 @@
 #define TASK_H
 
 #include "bp_tree.h"
+#include "hash_index.h"
 
 void task_1(Storage *storage);
-void task_2(BPlusTree *tree);
-void task_3(BPlusTree *tree, Storage *storage, int block_count);
+void task_2(BPlusTree<float> *tree);
+void task_3(BPlusTree<float> *tree, Storage *storage, int block_count);
+// Looks up the records whose indexed column equals key, through the hash index
+// and by a full scan.
+void point_lookups(HashIndex *index, Storage *storage, int block_count,
+                   uint32_t key);
 
 #endif // TASK_H